@@ -3,405 +3,8045 @@
 #include <string>       // For std::string
 #include <map>          // For storing variables
 #include <fstream>      // For reading files
+#include <vector>       // For parsed blocks and the frame stack
+#include <memory>       // For sharing parsed programs
+#include <deque>        // For the scheduler run queue
+#include <thread>       // For scheduler worker threads
+#include <mutex>        // For protecting the run queue
+#include <condition_variable> // For waking idle workers
+#include <algorithm>    // For std::min, std::max
+#include <cstdint>      // For fixed-size integers in hashes
+#include <cstdio>       // For std::rename
+#include <limits>       // For overflow checks
+#include <string_view>  // For scanning lines without copies
+#include <cctype>       // For std::isspace
+#include <cstring>      // For std::memchr, std::strerror
+#include <chrono>       // For short waits in --watch
+#include <unordered_map> // For profile counters
+#include <bitset>       // For regex character sets
+#include <atomic>       // For sharing work between reader threads
+#include <filesystem>   // For the result cache directory
+#include <type_traits>  // For wrapping arithmetic on unsigned numbers
+
+#if defined(__SSE2__)
+#include <emmintrin.h>  // For scanning CSV files and texts 16 bytes at a time
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>     // For _BitScanForward
+#endif
+
+#ifndef _WIN32
+#include <sys/socket.h> // For the --serve / --client Unix socket
+#include <sys/stat.h>   // For checking if a cached script changed
+#include <sys/un.h>
+#include <sys/wait.h>   // For waiting on checkpoint writer processes
+#include <signal.h>     // For stopping ploop workers when others can not start
+#include <sys/mman.h>   // For mapping snapshot files
+#include <fcntl.h>
+#include <unistd.h>
+#include <climits>      // For PATH_MAX
+#include <cstdlib>      // For realpath
+#endif
+
+#ifdef __linux__
+#include <elf.h>        // For finding the bundle section in the executable
+#include <sys/inotify.h> // For --watch
+#include <poll.h>
+#include <linux/perf_event.h> // For --perf-counters
+#include <linux/io_uring.h> // For readfiles
+#include <sys/epoll.h>  // For the timer event loop
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <cerrno>
+#endif
+
+// Marks a function that rarely runs (error reporting). The compiler keeps
+// it out of line and away from the hot code, so the code of a busy loop
+// stays dense.
+#if defined(__GNUC__)
+#define NAN_COLD __attribute__((cold, noinline))
+#elif defined(_MSC_VER)
+#define NAN_COLD __declspec(noinline)
+#else
+#define NAN_COLD
+#endif
 
 // ===============================
-// Simple Interpreter Class
+// Compact Binary Encoding
 // ===============================
-class Interpreter {
-private:
+// Used for checkpoints, snapshots and bytecode. Numbers are stored as
+// LEB128 varints (a small number takes a single byte), signed numbers
+// are zigzag-encoded first, and strings are a length followed by bytes.
+struct BinaryWriter {
 
-    // Map to store variables
-    // Example:
-    // set x = 5
-    // This will store: variables["x"] = 5
-    std::map<std::string, int> variables;
+    std::string data;
 
-public:
+    void number(uint64_t value) {
+        while (value >= 0x80) {
+            data += char((value & 0x7F) | 0x80);
+            value >>= 7;
+        }
+        data += char(value);
+    }
 
-    // ============================================
-    // Execute full script (multiple lines of code)
-    // ============================================
-void execute(const std::string& code) {
+    void signedNumber(int64_t value) {
+        number(((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+    }
 
-    std::istringstream stream(code);
-    std::string line;
+    void text(const std::string& value) {
+        number(value.size());
+        data += value;
+    }
+};
 
-    while (std::getline(stream, line)) {
+// Where stdout was when a checkpoint was taken. The file identity is
+// kept so that resuming only cuts output from the same file.
+struct OutputPosition {
+    long long offset = -1;      // -1 = stdout is not a regular file
+    uint64_t device = 0;
+    uint64_t inode = 0;
+};
 
-        if (line.empty())
-            continue;
+struct BinaryReader {
 
-        std::istringstream ss(line);
-        std::string command;
-        ss >> command;
+    const char* pos;
+    const char* end;
 
-        // =========================
-        // LOOP COMMAND
-        // =========================
-        if (command == "loop") {
+    // Becomes false as soon as anything is read past the end
+    bool ok = true;
 
-            std::string varAndCount;
-            ss >> varAndCount;
+    BinaryReader(const char* begin, size_t size) : pos(begin), end(begin + size) {}
 
-            // Example: i:10
-            size_t colonPos = varAndCount.find(':');
+    uint64_t number() {
 
-            std::string var = varAndCount.substr(0, colonPos);
-            int count = std::stoi(varAndCount.substr(colonPos + 1));
+        uint64_t value = 0;
 
-            // Expect "(" at end of line
-            std::string openParen;
-            ss >> openParen;
+        for (int shift = 0; shift < 64; shift += 7) {
 
-            if (openParen != "(") {
-                std::cout << "Syntax error: expected (\n";
-                continue;
+            if (pos == end) {
+                ok = false;
+                return 0;
             }
-            
-            // Calculate block separately to support nested loops and ifs
-            std::string block = readBlock(stream);
 
+            unsigned char byte = *pos++;
+            value |= (uint64_t)(byte & 0x7F) << shift;
 
-            // Execute loop
-            for (int i = 0; i < count; i++) {
-
-                variables[var] = i;
-                execute(block);  // Recursive call
-            }
+            if (!(byte & 0x80))
+                return value;
         }
 
-                // =========================
-        // IF COMMAND
-        // =========================
-        else if (command == "if") {
+        ok = false;
+        return 0;
+    }
 
-            // Get rest of line after "if"
-            std::string condition;
-            std::getline(ss, condition);
+    int64_t signedNumber() {
+        uint64_t value = number();
+        return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+    }
 
-            // Remove trailing "("
-            if (!condition.empty() && condition.back() == '(')
-                condition.pop_back();
+    std::string text() {
 
-            // Trim spaces
-            condition.erase(0, condition.find_first_not_of(" "));
-            condition.erase(condition.find_last_not_of(" ") + 1);
+        uint64_t size = number();
 
-            // Expect "("
-            std::string openParen;
-            ss >> openParen;
+        if (!ok || size > (uint64_t)(end - pos)) {
+            ok = false;
+            return "";
+        }
 
-            // If "(" is not at the end of line, it means condition is separated by space
-            std::string block = readBlock(stream);
+        std::string value(pos, size);
+        pos += size;
 
+        return value;
+    }
+};
 
-            if (evaluateCondition(condition)) {
-                execute(block);
-            }
-        }
+// ===============================
+// Regular Expressions (match)
+// ===============================
+// A pattern is compiled once, when the line that uses it is compiled,
+// into an NFA (Thompson's construction). Matching runs a DFA that is
+// built lazily from the NFA: every DFA state is a set of NFA states, and
+// its transitions are worked out the first time a character needs them.
+// Each input character costs one table lookup, so matching time is
+// linear in the length of the text, whatever the pattern and the text.
+//
+// Supported: literals, ".", [abc], [a-z], [^...], \d \w \s (and \D \W
+// \S), escaped special characters, ( ), |, *, + and ?, and ^ / $ at the
+// start / end of the pattern. Backreferences and other features that
+// need backtracking are refused, so no pattern can take exponential
+// time.
+class Regex {
+public:
 
+    explicit Regex(const std::string& pattern) : source(pattern) {
 
-        else {
-            runLine(line);
+        if (!source.empty() && source[0] == '^') {
+            anchorStart = true;
+            pos = 1;
         }
-    }
-}
 
+        Fragment whole = parseAlternation();
 
-private:
-
-    // ============================================
-    // Execute one single line of code
-    // ============================================
-    void runLine(const std::string& line) {
+        if (error.empty() && pos < source.size())
+            fail(source[pos] == ')' ? "unmatched )" : "unexpected " + std::string(1, source[pos]));
 
+        if (topLevelChoice && (anchorStart || anchorEnd))
+            fail("put ( ) around | when using ^ or $");
 
-        // Ignore empty lines
-        if (line.empty())
+        if (!error.empty())
             return;
 
-        // If line starts with "comment", ignore it
-        if (line.rfind("comment", 0) == 0)
-            return;
+        patch(whole, addState(State::Match));
+        start = whole.start;
+    }
 
+    Regex(const Regex&) = delete;
+    Regex& operator=(const Regex&) = delete;
 
-        // Create a stream for parsing the line
-        std::istringstream ss(line);
+    // The pattern it was made from
+    const std::string& pattern() const {
+        return source;
+    }
 
-        std::string command;
+    // Empty if the pattern compiled
+    const std::string& problem() const {
+        return error;
+    }
 
+    // Does the pattern match anywhere in `text`?
+    bool search(std::string_view text) {
 
-        // Read the first word (the command)
-        ss >> command;
+        // The DFA is shared by every thread running this line
+        std::lock_guard<std::mutex> lock(dfaMutex);
 
-        // =========================
-        // PRINT COMMAND
-        // =========================
-        if (command == "print") {
+        if (dfa.empty())
+            startState = stateFor(closure({ start }));
 
-            // Get everything after the word "print"
-            std::string restOfLine;
-            std::getline(ss, restOfLine);
+        int current = startState;
 
-            // Remove leading space (because getline keeps it)
-            if (!restOfLine.empty() && restOfLine[0] == ' ')
-                restOfLine.erase(0, 1);
+        for (unsigned char c : text) {
 
-            // ---------------------------------------
-            // Case 1: If it's a quoted string
-            // Example:
-            // print "Hello World"
-            // ---------------------------------------
-            if (restOfLine.size() >= 2 &&
-                restOfLine.front() == '"' &&
-                restOfLine.back() == '"') {
+            if (dfa[current].accepting && !anchorEnd)
+                return true;
 
-                // Remove the quotes
-                std::string text =
-                    restOfLine.substr(1, restOfLine.size() - 2);
+            // Nothing can match any more
+            if (dfa[current].nfaStates.empty())
+                return false;
 
-                std::cout << text << std::endl;
-            }
+            int next = dfa[current].next[c];
 
-            // ---------------------------------------
-            // Case 2: If it's a variable name
-            // Example:
-            // print x
-            // ---------------------------------------
-            else {
+            if (next < 0)
+                next = step(current, c);
 
-                if (variables.count(restOfLine)) {
-                    std::cout << variables[restOfLine] << std::endl;
-                }
-                else {
-                    // If not a variable, just print as-is
-                    std::cout << restOfLine << std::endl;
-                }
-            }
+            current = next;
         }
 
-        // =========================
-        // SET COMMAND
-        // =========================
-        // Example:
-        // set x = 5
-        else if (command == "set") {
+        return dfa[current].accepting;
+    }
 
-            std::string var;
-            std::string valueToken;
+private:
 
-            ss >> var >> valueToken;
+    // ---------- NFA ----------
 
-            // Case 1: set x = 5
-            if (valueToken == "=") {
-                ss >> valueToken;
-            }
+    struct State {
+        enum Kind { Char, Split, Match } kind;
+        std::bitset<256> chars;     // Char: the characters it accepts
+        int out = -1;               // Next state
+        int out1 = -1;              // Split: the other next state
+    };
 
-            // Now valueToken can be:
-            // - a number
-            // - a variable name
+    // A piece of the NFA with exits that still lead nowhere
+    struct Fragment {
+        int start;
+        std::vector<std::pair<int, bool>> exits;   // State, and out1 (true) or out
+    };
 
-            // Check if it's a number
-            if (std::isdigit(valueToken[0]) || 
-                (valueToken[0] == '-' && valueToken.size() > 1)) {
+    std::string source;
+    size_t pos = 0;
+    std::string error;
 
-                variables[var] = std::stoi(valueToken);
-            }
-            else {
-                // Otherwise treat it as variable
-                if (variables.count(valueToken)) {
-                    variables[var] = variables[valueToken];
-                }
-                else {
-                    std::cout << "Error: variable '" 
-                            << valueToken 
-                            << "' not found\n";
-                }
-            }
-        }
+    std::vector<State> nfa;
+    int start = 0;
+    bool anchorStart = false;
+    bool anchorEnd = false;
 
+    int depth = 0;                  // Groups open while parsing
+    bool topLevelChoice = false;    // A | outside any group
 
-        // =========================
-        // ADD COMMAND
-        // =========================
-        // Example:
-        // add x 3
-        else if (command == "add") {
+    int addState(State::Kind kind) {
+        nfa.push_back(State{ kind, {}, -1, -1 });
+        return (int)nfa.size() - 1;
+    }
 
-            std::string var;
-            int value;
+    void patch(const Fragment& fragment, int target) {
+        for (const auto& exit : fragment.exits)
+            (exit.second ? nfa[exit.first].out1 : nfa[exit.first].out) = target;
+    }
 
-            ss >> var >> value;
+    void fail(const std::string& message) {
+        if (error.empty())
+            error = message;
+    }
 
-            // Only add if variable exists
-            if (variables.count(var)) {
-                variables[var] += value;
-            }
-            else {
-                std::cout << "Error: variable '" << var << "' not found\n";
-            }
-        }
+    // An empty fragment (matches nothing, e.g. "()" or "a|")
+    Fragment empty() {
+        int split = addState(State::Split);
+        return Fragment{ split, { { split, false }, { split, true } } };
+    }
 
-        // =========================
-        // SUB COMMAND
-        // Example:
-        // sub x 3
-        // =========================
-        else if (command == "sub") {
+    Fragment parseAlternation() {
 
-            std::string var;
-            int value;
+        Fragment left = parseSequence();
 
-            ss >> var >> value;
+        while (error.empty() && pos < source.size() && source[pos] == '|') {
 
-            if (variables.count(var)) {
-                variables[var] -= value;
-            }
-            else {
-                std::cout << "Error: variable '" << var << "' not found\n";
-            }
+            // "^a|b" could mean "^(a|b)" or "(^a)|b"
+            if (depth == 0)
+                topLevelChoice = true;
+
+            pos++;
+            Fragment right = parseSequence();
+
+            int split = addState(State::Split);
+            nfa[split].out = left.start;
+            nfa[split].out1 = right.start;
+
+            left.start = split;
+            left.exits.insert(left.exits.end(), right.exits.begin(), right.exits.end());
         }
 
-        // =========================
-        // MULT COMMAND
-        // Example:
-        // mult x 3
-        // =========================
-        else if (command == "mult") {
+        return left;
+    }
 
-            std::string var;
-            int value;
+    Fragment parseSequence() {
 
-            ss >> var >> value;
+        Fragment sequence{ -1, {} };
+        bool first = true;
 
-            if (variables.count(var)) {
-                variables[var] *= value;
+        while (error.empty() && pos < source.size() &&
+               source[pos] != '|' && source[pos] != ')') {
+
+            // $ is only supported at the very end
+            if (source[pos] == '$') {
+                if (pos + 1 != source.size())
+                    fail("$ is only supported at the end of the pattern");
+                anchorEnd = true;
+                pos++;
+                break;
+            }
+
+            Fragment next = parseRepeat();
+
+            if (first) {
+                sequence = next;
+                first = false;
             }
             else {
-                std::cout << "Error: variable '" << var << "' not found\n";
+                patch(sequence, next.start);
+                sequence.exits = next.exits;
             }
         }
 
-        // =========================
-        // DIV COMMAND
-        // Example:
-        // div x 2
-        // =========================
-        else if (command == "div") {
+        return first ? empty() : sequence;
+    }
 
-            std::string var;
-            int value;
+    Fragment parseRepeat() {
 
-            ss >> var >> value;
+        Fragment atom = parseAtom();
 
-            if (!variables.count(var)) {
-                std::cout << "Error: variable '" << var << "' not found\n";
-                return;
-            }
+        while (error.empty() && pos < source.size() &&
+               (source[pos] == '*' || source[pos] == '+' || source[pos] == '?')) {
 
-            if (value == 0) {
-                std::cout << "Error: division by zero\n";
-                return;
+            char op = source[pos++];
+            int split = addState(State::Split);
+
+            nfa[split].out = atom.start;
+
+            if (op == '?') {
+                atom.start = split;
+                atom.exits.push_back({ split, true });
             }
+            else {
+                // Loop back from the end of the atom
+                patch(atom, split);
+                atom.exits = { { split, true } };
 
-            variables[var] /= value;
+                if (op == '*')
+                    atom.start = split;
+            }
         }
 
-        // =========================
-        // UNKNOWN COMMAND
-        // =========================
-        else {
-            std::cout << "Unknown command: " << command << std::endl;
-        }
+        if (error.empty() && pos < source.size() && source[pos] == '{')
+            fail("{ } repeats are not supported");
+
+        return atom;
     }
-    
-    bool evaluateCondition(const std::string& condition) {
 
-        std::istringstream ss(condition);
+    Fragment parseAtom() {
 
-        std::string left, op, right;
-        ss >> left >> op >> right;
+        char c = source[pos++];
 
-        int leftVal = 0;
-        int rightVal = 0;
+        if (c == '(') {
 
-        // Left value
-        if (variables.count(left))
-            leftVal = variables[left];
-        else
-            leftVal = std::stoi(left);
+            if (pos < source.size() && source[pos] == '?')
+                fail("(? groups are not supported");
 
-        // Right value
-        if (variables.count(right))
-            rightVal = variables[right];
-        else
-            rightVal = std::stoi(right);
+            depth++;
+            Fragment group = pos < source.size() && source[pos] == ')' ? empty() : parseAlternation();
+            depth--;
 
-        // Comparison
-        if (op == ">")  return leftVal > rightVal;
-        if (op == "<")  return leftVal < rightVal;
-        if (op == ">=") return leftVal >= rightVal;
-        if (op == "<=") return leftVal <= rightVal;
-        if (op == "==") return leftVal == rightVal;
-        if (op == "!=") return leftVal != rightVal;
+            if (pos >= source.size() || source[pos] != ')')
+                fail("missing )");
 
-        std::cout << "Invalid operator in condition\n";
-        return false;
-    }
+            pos++;
+            return group;
+        }
 
-    std::string readBlock(std::istringstream& stream) {
-    std::string block;
-    std::string line;
-    int depth = 1;
+        int state = addState(State::Char);
+        std::bitset<256>& chars = nfa[state].chars;
 
-    while (std::getline(stream, line)) {
+        if (c == '.')
+            chars.set();
+        else if (c == '[')
+            parseClass(chars);
+        else if (c == '\\')
+            parseEscape(chars);
+        else if (c == '*' || c == '+' || c == '?')
+            fail(std::string("nothing to repeat before ") + c);
+        else if (c == '^')
+            fail("^ is only supported at the start of the pattern");
+        else
+            chars.set((unsigned char)c);
 
-        for (char c : line) {
-            if (c == '(') depth++;
-            else if (c == ')') depth--;
+        return Fragment{ state, { { state, false } } };
+    }
+
+    // After a backslash: \d \w \s, their opposites, or a literal character
+    void parseEscape(std::bitset<256>& chars) {
+
+        if (pos >= source.size()) {
+            fail("pattern ends with \\");
+            return;
         }
 
-        if (depth == 0)
-            break;
+        char c = source[pos++];
+        std::bitset<256> set;
 
-        block += line + "\n";
+        for (int i = 0; i < 256; i++) {
+            if ((c == 'd' || c == 'D') && std::isdigit(i)) set.set(i);
+            if ((c == 'w' || c == 'W') && (std::isalnum(i) || i == '_')) set.set(i);
+            if ((c == 's' || c == 'S') && std::isspace(i)) set.set(i);
+        }
+
+        if (c == 'd' || c == 'w' || c == 's')
+            chars |= set;
+        else if (c == 'D' || c == 'W' || c == 'S')
+            chars |= ~set;
+        else if (c >= '1' && c <= '9')
+            fail("backreferences are not supported");
+        else if (c == 'n')
+            chars.set('\n');
+        else if (c == 't')
+            chars.set('\t');
+        else
+            chars.set((unsigned char)c);
     }
 
-    return block;
-}
+    void parseClass(std::bitset<256>& chars) {
 
+        bool negate = pos < source.size() && source[pos] == '^';
 
+        if (negate)
+            pos++;
 
-};
+        bool first = true;
 
-// ============================================
-// MAIN FUNCTION
+        while (pos < source.size() && (source[pos] != ']' || first)) {
+
+            first = false;
+            unsigned char from = source[pos++];
+
+            if (from == '\\') {
+                parseEscape(chars);
+                continue;
+            }
+
+            // A range like a-z (a "-" at the end is a literal)
+            if (pos + 1 < source.size() && source[pos] == '-' && source[pos + 1] != ']') {
+
+                unsigned char to = source[pos + 1];
+                pos += 2;
+
+                for (int i = from; i <= to; i++)
+                    chars.set(i);
+            }
+            else {
+                chars.set(from);
+            }
+        }
+
+        if (pos >= source.size()) {
+            fail("missing ]");
+            return;
+        }
+
+        pos++;
+
+        if (negate)
+            chars.flip();
+    }
+
+    // ---------- DFA ----------
+
+    struct DfaState {
+        std::vector<int> nfaStates;     // Sorted; only Char and Match states
+        bool accepting = false;
+        int next[256];                  // -1: not worked out yet
+    };
+
+    // States kept at most; when full the DFA is thrown away and built
+    // again, so memory stays bounded (and matching stays linear)
+    static const size_t maxDfaStates = 1024;
+
+    std::vector<DfaState> dfa;
+    std::map<std::vector<int>, int> dfaIds;
+    int startState = 0;
+    std::mutex dfaMutex;
+
+    // The Char and Match states reachable from `states` without input
+    std::vector<int> closure(std::vector<int> pending) const {
+
+        std::vector<bool> seen(nfa.size(), false);
+        std::vector<int> result;
+
+        while (!pending.empty()) {
+
+            int s = pending.back();
+            pending.pop_back();
+
+            if (s < 0 || seen[s])
+                continue;
+
+            seen[s] = true;
+
+            if (nfa[s].kind == State::Split) {
+                pending.push_back(nfa[s].out1);
+                pending.push_back(nfa[s].out);
+            }
+            else {
+                result.push_back(s);
+            }
+        }
+
+        std::sort(result.begin(), result.end());
+
+        return result;
+    }
+
+    int stateFor(std::vector<int> states) {
+
+        auto it = dfaIds.find(states);
+
+        if (it != dfaIds.end())
+            return it->second;
+
+        DfaState state;
+        state.nfaStates = states;
+        std::fill(std::begin(state.next), std::end(state.next), -1);
+
+        for (int s : states)
+            state.accepting = state.accepting || nfa[s].kind == State::Match;
+
+        dfa.push_back(std::move(state));
+        dfaIds[std::move(states)] = (int)dfa.size() - 1;
+
+        return (int)dfa.size() - 1;
+    }
+
+    // Work out (and remember) where `current` goes on `c`
+    int step(int current, unsigned char c) {
+
+        std::vector<int> targets;
+
+        for (int s : dfa[current].nfaStates)
+            if (nfa[s].kind == State::Char && nfa[s].chars[c])
+                targets.push_back(nfa[s].out);
+
+        // Not anchored: a match may also start at the next character
+        if (!anchorStart)
+            targets.push_back(start);
+
+        std::vector<int> states = closure(std::move(targets));
+
+        if (dfa.size() >= maxDfaStates && !dfaIds.count(states)) {
+            dfa.clear();
+            dfaIds.clear();
+            startState = stateFor(closure({ start }));
+            return stateFor(std::move(states));
+        }
+
+        int next = stateFor(std::move(states));
+        dfa[current].next[c] = next;
+
+        return next;
+    }
+};
+
+// ===============================
+// Parsed Program Structure
+// ===============================
+// A script is parsed into a tree of blocks before it runs.
+// Loop and if bodies become child blocks, every other line is kept
+// as text and handed to runLine when it executes.
+//
+// Only the top level is parsed up front. For a body, the parser just
+// finds where it ends; the body itself is parsed the first time it
+// runs (see LazyBlock), so code that never runs is never parsed.
+struct Block;
+class LazyBlock;
+
+struct Statement {
+
+    enum Kind {
+        Line,       // Any simple command (print, set, add, ...)
+        Loop,       // loop i:10 (
+        Ploop,      // ploop i:10 (  (a loop that may run in several processes)
+        If,         // if x > 3 (
+        While,      // while x < 10 (
+        Every,      // every 1000 (
+        After,      // after 500 (
+        BadLoop     // loop without "(" (reported when reached)
+    };
+
+    Kind kind = Line;
+
+    // Line number in the original file (starts at 1)
+    int lineNumber = 0;
+
+    // The original text of the line
+    std::string text;
+
+    // Line only: where its instruction starts in the block's bytecode
+    uint32_t codeOffset = 0;
+
+    // Loop / Ploop only: loop variable and iteration count
+    std::string loopVar;
+    int loopCount = 0;
+
+    // Loop / Ploop only: set by --use-profile for loops that ran many
+    // times per entry and whose body only has simple lines. Their
+    // iterations skip the frame loop (see runStraight).
+    mutable bool straight = false;
+
+    // If / While only: the condition, e.g. "x > 3".
+    // Every / After only: the time in milliseconds (variable or number)
+    std::string condition;
+
+    // Every kind but Line and BadLoop: the block inside the parentheses
+    std::shared_ptr<LazyBlock> body;
+};
+
+struct Block {
+    std::vector<Statement> statements;
+
+    // Instructions for the simple lines (see encodeBlock), and the
+    // names and texts they refer to
+    std::string code;
+    std::vector<std::string> constants;
+
+    // Patterns of the match lines, compiled once (see OpMatch)
+    std::vector<std::shared_ptr<Regex>> patterns;
+};
+
+// A loop or if body, parsed on first use and then kept.
+// Safe to use from several threads at once.
+class LazyBlock {
+private:
+
+    // The whole script, shared by every body in it
+    std::shared_ptr<const std::string> source;
+
+    // Where the body is in the script
+    size_t begin;
+    size_t end;
+    int firstLine;
+
+    mutable std::once_flag parsed;
+    mutable std::shared_ptr<const Block> block;
+
+public:
+
+    LazyBlock(std::shared_ptr<const std::string> script, size_t bodyBegin,
+              size_t bodyEnd, int bodyFirstLine)
+        : source(std::move(script)), begin(bodyBegin), end(bodyEnd),
+          firstLine(bodyFirstLine) {}
+
+    // A body that is already parsed (see readProgram)
+    explicit LazyBlock(std::shared_ptr<const Block> ready)
+        : begin(0), end(0), firstLine(0), block(std::move(ready)) {}
+
+    // The parsed body (parses it the first time)
+    const Block& get() const;
+
+    // The same body after its lines moved by `lines` in the script
+    std::shared_ptr<LazyBlock> moved(int lines) const {
+        return std::make_shared<LazyBlock>(source, begin, end, firstLine + lines);
+    }
+};
+
+// How often a loop or if ran, recorded with --record-profile
+struct ProfileCounters {
+    uint64_t entries = 0;   // Times the statement was reached
+    uint64_t taken = 0;     // If / While: times the body was entered. Loop / Ploop: iterations
+};
+
+using ProfileData = std::unordered_map<const Statement*, ProfileCounters>;
+
+// ===============================
+// Bytecode
+// ===============================
+// Every simple line is compiled once into one instruction, so running it
+// does not parse text again. An instruction is a 1-byte opcode followed
+// by LEB128 operands: indices into the block's constant pool for names
+// and texts, zigzag numbers for values. All instructions of a block are
+// packed together, so a loop body fits in a few cache lines.
+enum OpCode : uint8_t {
+    OpNop,          // comment
+    OpPrintText,    // text               print "Hello"
+    OpPrintVar,     // name               print x (prints "x" if there is no x)
+    OpSetConst,     // name, value        set x = 5
+    OpSetVar,       // name, source name  set x = y
+    OpSetText,      // name, text         set s = "Hello"
+    OpAdd,          // name, value        add x 5
+    OpSub,          // name, value        sub x 5
+    OpMult,         // name, value        mult x 5
+    OpDiv,          // name, value        div x 5
+    OpOpen,         // handle, path, mode open f "data.txt" read
+    OpReadLine,     // handle, name       readline f s
+    OpReadInt,      // handle, name       readint f x
+    OpWriteText,    // handle, text       write f "Hello"
+    OpWriteVar,     // handle, name       write f x
+    OpClose,        // handle             close f
+    OpLoad,         // path, count, names load "data.csv" cols a b c
+    OpArray,        // name, path, size   array a 100 / array a mapped "a.bin" 100
+    OpSave,         // name, path, flag   save a "a.nanbin" [compressed]
+    OpFind,         // text, needle, quoted, name  find s "needle" pos
+    OpContains,     // text, needle, quoted, name  contains s "needle" ok
+    OpSplit,        // text, separator, quoted, array  split s "," parts
+    OpMatch,        // text, pattern, name  match s "a+b" ok (pattern: index in patterns)
+    OpReadFiles,    // paths, name        readfiles paths contents
+    OpLoadArray,    // name, path, flag   load a "a.nanbin" [verify]
+    OpSize,         // array, name        size a n
+    OpGet,          // array, index, name get a i x
+    OpPut,          // array, index, value put a i x
+    OpCheckpoint,   //                    checkpoint
+    OpSleep,        // milliseconds       sleep 500 / sleep ms
+    OpStop,         //                    stop (inside every)
+    OpUnknown,      // command            anything else
+    OpLine          //                    run the text with runLine
+};
+
+// Read an operand (the code is trusted, so there are no bounds checks)
+inline uint64_t decodeNumber(const unsigned char*& pc) {
+
+    uint64_t value = 0;
+    int shift = 0;
+
+    while (*pc & 0x80) {
+        value |= (uint64_t)(*pc++ & 0x7F) << shift;
+        shift += 7;
+    }
+
+    return value | (uint64_t)*pc++ << shift;
+}
+
+inline int64_t decodeSigned(const unsigned char*& pc) {
+    uint64_t value = decodeNumber(pc);
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+// Constant pool of one block, without duplicates
+struct ConstantPool {
+
+    std::vector<std::string>& constants;
+    std::map<std::string, uint64_t> indexes;
+    std::vector<std::shared_ptr<Regex>>& patterns;
+
+    uint64_t addPattern(const std::string& pattern) {
+        patterns.push_back(std::make_shared<Regex>(pattern));
+        return patterns.size() - 1;
+    }
+
+    uint64_t add(const std::string& value) {
+
+        auto it = indexes.find(value);
+        if (it != indexes.end())
+            return it->second;
+
+        constants.push_back(value);
+        indexes[value] = constants.size() - 1;
+
+        return constants.size() - 1;
+    }
+};
+
+// ============================================
+// Which kind of load is this?
+// ============================================
+// "load" has two forms:
+//   load "data.csv" cols a b c   - columns from a CSV file
+//   load a "a.nanbin"            - one array from a .nanbin file
+// The CSV form is the one with "cols" after the path (or a quoted
+// first word, since an array name is never quoted). The stream is
+// left just after the spaces following "load".
+static bool isCsvLoad(std::istringstream& ss) {
+
+    ss >> std::ws;
+
+    if (ss.peek() == '"')
+        return true;
+
+    std::streampos start = ss.tellg();
+    std::string first;
+    std::string word;
+
+    ss >> first >> word;
+
+    ss.clear();
+    ss.seekg(start);
+
+    return word == "cols";
+}
+
+// ============================================
+// Compile one simple line into an instruction
+// ============================================
+// Reads the line exactly the way runLine does. Values that might not
+// fit every integer size (see RuntimePolicy) become OpLine, so runLine
+// handles them at run time.
+static void encodeLine(const std::string& line, BinaryWriter& code, ConstantPool& pool) {
+
+    if (line.rfind("comment", 0) == 0) {
+        code.number(OpNop);
+        return;
+    }
+
+    std::istringstream ss(line);
+    std::string command;
+    ss >> command;
+
+    auto fitsAnyInt = [](long long value) {
+        return value >= INT32_MIN && value <= INT32_MAX;
+    };
+
+    if (command == "print") {
+
+        std::string restOfLine;
+        std::getline(ss, restOfLine);
+
+        if (!restOfLine.empty() && restOfLine[0] == ' ')
+            restOfLine.erase(0, 1);
+
+        if (restOfLine.size() >= 2 &&
+            restOfLine.front() == '"' &&
+            restOfLine.back() == '"') {
+            code.number(OpPrintText);
+            code.number(pool.add(restOfLine.substr(1, restOfLine.size() - 2)));
+        }
+        else {
+            code.number(OpPrintVar);
+            code.number(pool.add(restOfLine));
+        }
+    }
+    else if (command == "set") {
+
+        std::string var;
+        std::string valueToken;
+
+        ss >> var >> valueToken;
+
+        if (valueToken == "=")
+            ss >> valueToken;
+
+        if (valueToken.size() >= 1 && valueToken[0] == '"') {
+
+            // A text: everything between the first and the last quote
+            size_t open = line.find('"');
+            size_t close = line.rfind('"');
+
+            code.number(OpSetText);
+            code.number(pool.add(var));
+            code.number(pool.add(close > open ? line.substr(open + 1, close - open - 1) : ""));
+        }
+        else if (std::isdigit((unsigned char)valueToken[0]) ||
+            (valueToken[0] == '-' && valueToken.size() > 1)) {
+
+            long long value = 0;
+
+            try {
+                value = std::stoll(valueToken);
+            }
+            catch (const std::exception&) {
+                code.number(OpLine);
+                return;
+            }
+
+            if (!fitsAnyInt(value)) {
+                code.number(OpLine);
+                return;
+            }
+
+            code.number(OpSetConst);
+            code.number(pool.add(var));
+            code.signedNumber(value);
+        }
+        else {
+            code.number(OpSetVar);
+            code.number(pool.add(var));
+            code.number(pool.add(valueToken));
+        }
+    }
+    else if (command == "add" || command == "sub" ||
+             command == "mult" || command == "div") {
+
+        std::string var;
+        long long value = 0;
+
+        // A missing or bad number reads as 0, like in runLine
+        ss >> var >> value;
+
+        if (!fitsAnyInt(value)) {
+            code.number(OpLine);
+            return;
+        }
+
+        code.number(command == "add" ? OpAdd :
+                    command == "sub" ? OpSub :
+                    command == "mult" ? OpMult : OpDiv);
+        code.number(pool.add(var));
+        code.signedNumber(value);
+    }
+    else if (command == "open") {
+
+        // open f "path with spaces.txt" read|write|append
+        std::string handle;
+        std::string path;
+        std::string mode;
+
+        ss >> handle >> std::ws;
+
+        if (ss.peek() == '"') {
+            ss.get();
+            std::getline(ss, path, '"');
+        }
+        else {
+            ss >> path;
+        }
+
+        ss >> mode;
+
+        code.number(OpOpen);
+        code.number(pool.add(handle));
+        code.number(pool.add(path));
+        code.number(pool.add(mode));
+    }
+    else if (command == "readline" || command == "readint") {
+
+        std::string handle;
+        std::string var;
+
+        ss >> handle >> var;
+
+        code.number(command == "readline" ? OpReadLine : OpReadInt);
+        code.number(pool.add(handle));
+        code.number(pool.add(var));
+    }
+    else if (command == "write") {
+
+        // write f <anything print accepts>
+        std::string handle;
+        std::string restOfLine;
+
+        ss >> handle;
+        std::getline(ss, restOfLine);
+
+        if (!restOfLine.empty() && restOfLine[0] == ' ')
+            restOfLine.erase(0, 1);
+
+        bool quoted = restOfLine.size() >= 2 &&
+                      restOfLine.front() == '"' &&
+                      restOfLine.back() == '"';
+
+        code.number(quoted ? OpWriteText : OpWriteVar);
+        code.number(pool.add(handle));
+        code.number(pool.add(quoted ? restOfLine.substr(1, restOfLine.size() - 2)
+                                    : restOfLine));
+    }
+    else if (command == "close") {
+
+        std::string handle;
+        ss >> handle;
+
+        code.number(OpClose);
+        code.number(pool.add(handle));
+    }
+    else if (command == "save" || (command == "load" && !isCsvLoad(ss))) {
+
+        // save a "a.nanbin" [compressed]  /  load a "a.nanbin" [verify]
+        std::string name;
+        std::string path;
+        std::string word;
+
+        ss >> name >> std::ws;
+
+        if (ss.peek() == '"') {
+            ss.get();
+            std::getline(ss, path, '"');
+        }
+        else {
+            ss >> path;
+        }
+
+        ss >> word;
+
+        code.number(command == "save" ? OpSave : OpLoadArray);
+        code.number(pool.add(name));
+        code.number(pool.add(path));
+
+        code.number(word == (command == "save" ? "compressed" : "verify"));
+    }
+    else if (command == "load") {
+
+        // load "data.csv" cols a b c
+        std::string path;
+        std::string word;
+        std::vector<std::string> names;
+
+        if (ss.peek() == '"') {
+            ss.get();
+            std::getline(ss, path, '"');
+        }
+        else {
+            ss >> path;
+        }
+
+        // No "cols" (or no columns) is reported when the line runs
+        if (ss >> word && word == "cols")
+            while (ss >> word)
+                names.push_back(word);
+
+        code.number(OpLoad);
+        code.number(pool.add(path));
+        code.number(names.size());
+
+        for (const std::string& name : names)
+            code.number(pool.add(name));
+    }
+    else if (command == "array") {
+
+        // array a 100  /  array a mapped "a.bin" [100]
+        // An empty path means an in-memory array
+        std::string name;
+        std::string word;
+        std::string path;
+        std::string count;
+
+        ss >> name >> word;
+
+        if (word == "mapped") {
+
+            ss >> std::ws;
+
+            if (ss.peek() == '"') {
+                ss.get();
+                std::getline(ss, path, '"');
+            }
+            else {
+                ss >> path;
+            }
+
+            ss >> count;
+        }
+        else {
+            count = word;
+        }
+
+        code.number(OpArray);
+        code.number(pool.add(name));
+        code.number(pool.add(path));
+        code.number(pool.add(count));
+    }
+    else if (command == "find" || command == "contains" || command == "split") {
+
+        // find s "needle" pos  /  find s needle pos (needle: a variable)
+        std::string text;
+        std::string needle;
+        std::string target;
+        bool quoted = false;
+
+        ss >> text >> std::ws;
+
+        if (ss.peek() == '"') {
+            ss.get();
+            std::getline(ss, needle, '"');
+            quoted = true;
+        }
+        else {
+            ss >> needle;
+        }
+
+        ss >> target;
+
+        code.number(command == "find" ? OpFind : command == "contains" ? OpContains : OpSplit);
+        code.number(pool.add(text));
+        code.number(pool.add(needle));
+        code.number(quoted);
+        code.number(pool.add(target));
+    }
+    else if (command == "match") {
+
+        // match s "pattern" ok
+        std::string text;
+        std::string pattern;
+        std::string target;
+
+        ss >> text >> std::ws;
+
+        if (ss.peek() == '"') {
+            ss.get();
+
+            // The pattern ends at the last quote, so it may contain quotes
+            std::string rest;
+            std::getline(ss, rest);
+
+            size_t close = rest.rfind('"');
+            pattern = rest.substr(0, close);
+
+            if (close != std::string::npos)
+                std::istringstream(rest.substr(close + 1)) >> target;
+        }
+
+        code.number(OpMatch);
+        code.number(pool.add(text));
+        code.number(pool.addPattern(pattern));
+        code.number(pool.add(target));
+    }
+    else if (command == "readfiles") {
+
+        std::string paths;
+        std::string target;
+
+        ss >> paths >> target;
+
+        code.number(OpReadFiles);
+        code.number(pool.add(paths));
+        code.number(pool.add(target));
+    }
+    else if (command == "size") {
+
+        std::string array;
+        std::string var;
+
+        ss >> array >> var;
+
+        code.number(OpSize);
+        code.number(pool.add(array));
+        code.number(pool.add(var));
+    }
+    else if (command == "get" || command == "put") {
+
+        // get a i x  /  put a i x (i and x: variables or numbers)
+        std::string array;
+        std::string index;
+        std::string value;
+
+        ss >> array >> index >> value;
+
+        code.number(command == "get" ? OpGet : OpPut);
+        code.number(pool.add(array));
+        code.number(pool.add(index));
+        code.number(pool.add(value));
+    }
+    else if (command == "checkpoint") {
+        code.number(OpCheckpoint);
+    }
+    else if (command == "sleep") {
+
+        std::string milliseconds;
+        ss >> milliseconds;
+
+        code.number(OpSleep);
+        code.number(pool.add(milliseconds));
+    }
+    else if (command == "stop") {
+        code.number(OpStop);
+    }
+    else {
+        code.number(OpUnknown);
+        code.number(pool.add(command));
+    }
+}
+
+// Instructions that rarely run: fallbacks and commands that only
+// report an error or do slow work anyway
+static bool isColdInstruction(OpCode op) {
+    return op == OpUnknown || op == OpLine || op == OpCheckpoint ||
+           op == OpOpen || op == OpClose || op == OpLoad || op == OpArray ||
+           op == OpSave || op == OpLoadArray || op == OpReadFiles ||
+           op == OpSleep || op == OpStop;
+}
+
+// Compile every simple line of a block.
+// Hot instructions are packed first and cold ones after them, so the
+// instructions a loop body really runs share as few cache lines as
+// possible.
+static void encodeBlock(Block& block) {
+
+    BinaryWriter hot;
+    BinaryWriter cold;
+    std::vector<Statement*> coldStatements;
+    ConstantPool pool{ block.constants, {}, block.patterns };
+
+    block.constants.clear();
+    block.patterns.clear();
+
+    for (Statement& statement : block.statements) {
+
+        if (statement.kind != Statement::Line)
+            continue;
+
+        BinaryWriter instruction;
+        encodeLine(statement.text, instruction, pool);
+
+        BinaryWriter& region = isColdInstruction((OpCode)instruction.data[0]) ? cold : hot;
+
+        statement.codeOffset = (uint32_t)region.data.size();
+        region.data += instruction.data;
+
+        if (&region == &cold)
+            coldStatements.push_back(&statement);
+    }
+
+    // The cold region starts after the hot one
+    for (Statement* statement : coldStatements)
+        statement->codeOffset += (uint32_t)hot.data.size();
+
+    block.code = std::move(hot.data);
+    block.code += cold.data;
+}
+
+// ============================================
+// Take the next line of source[pos, end)
+// ============================================
+// Works like std::getline: returns false when there is nothing left.
+static bool nextLine(const std::string& source, size_t& pos, size_t end,
+                     std::string& line) {
+
+    if (pos >= end)
+        return false;
+
+    size_t lineEnd = source.find('\n', pos);
+
+    if (lineEnd == std::string::npos || lineEnd > end)
+        lineEnd = end;
+
+    line.assign(source, pos, lineEnd - pos);
+    pos = std::min(lineEnd + 1, end);
+
+    return true;
+}
+
+// ============================================
+// Skip the lines of a block up to its closing ")"
+// ============================================
+// Returns where the body ends (the start of the closing line).
+// pos and lineNumber are moved past every line that is consumed.
+static size_t skipBlock(const std::string& source, size_t& pos, size_t end,
+                        int& lineNumber) {
+
+    std::string line;
+    int depth = 1;
+
+    while (true) {
+
+        size_t lineStart = pos;
+
+        if (!nextLine(source, pos, end, line))
+            return end;
+
+        lineNumber++;
+
+        for (char c : line) {
+            if (c == '(') depth++;
+            else if (c == ')') depth--;
+        }
+
+        if (depth == 0)
+            return lineStart;
+    }
+}
+
+// ============================================
+// Parse the lines source[begin, end) into a block
+// ============================================
+// With `encode` false the bytecode is left out; the caller is going to
+// join the statements into a bigger block and encode that instead.
+static std::shared_ptr<const Block> parseBlock(const std::shared_ptr<const std::string>& source,
+                                               size_t begin, size_t end, int firstLine,
+                                               bool encode = true) {
+
+    auto block = std::make_shared<Block>();
+
+    const std::string& code = *source;
+    size_t pos = begin;
+    std::string line;
+    int lineNumber = firstLine - 1;
+
+    while (nextLine(code, pos, end, line)) {
+
+        lineNumber++;
+
+        if (line.empty())
+            continue;
+
+        std::istringstream ss(line);
+        std::string command;
+        ss >> command;
+
+        Statement statement;
+        statement.lineNumber = lineNumber;
+        statement.text = line;
+
+        // =========================
+        // LOOP COMMAND
+        // =========================
+        if (command == "loop" || command == "ploop") {
+
+            std::string varAndCount;
+            ss >> varAndCount;
+
+            // Example: i:10
+            size_t colonPos = varAndCount.find(':');
+
+            statement.loopVar = varAndCount.substr(0, colonPos);
+            statement.loopCount = std::stoi(varAndCount.substr(colonPos + 1));
+
+            // Expect "(" at end of line
+            std::string openParen;
+            ss >> openParen;
+
+            if (openParen != "(") {
+                // The error is printed when the loop is reached,
+                // and the lines below it run as normal lines
+                statement.kind = Statement::BadLoop;
+            }
+            else {
+                int bodyLine = lineNumber + 1;
+                size_t bodyBegin = pos;
+
+                // Only find the end of the body here, to support nested
+                // loops and ifs; it is parsed when it first runs
+                size_t bodyEnd = skipBlock(code, pos, end, lineNumber);
+
+                statement.kind = command == "loop" ? Statement::Loop : Statement::Ploop;
+                statement.body = std::make_shared<LazyBlock>(source, bodyBegin,
+                                                             bodyEnd, bodyLine);
+            }
+        }
+
+        // =========================
+        // IF / WHILE COMMAND
+        // =========================
+        else if (command == "if" || command == "while") {
+
+            // Get rest of line after "if" / "while"
+            std::string condition;
+            std::getline(ss, condition);
+
+            // Remove trailing "("
+            if (!condition.empty() && condition.back() == '(')
+                condition.pop_back();
+
+            // Trim spaces
+            condition.erase(0, condition.find_first_not_of(" "));
+            condition.erase(condition.find_last_not_of(" ") + 1);
+
+            int bodyLine = lineNumber + 1;
+            size_t bodyBegin = pos;
+            size_t bodyEnd = skipBlock(code, pos, end, lineNumber);
+
+            statement.kind = command == "if" ? Statement::If : Statement::While;
+            statement.condition = condition;
+            statement.body = std::make_shared<LazyBlock>(source, bodyBegin,
+                                                         bodyEnd, bodyLine);
+        }
+
+        // =========================
+        // EVERY / AFTER COMMAND
+        // =========================
+        else if (command == "every" || command == "after") {
+
+            // Example: every 1000 (   (milliseconds)
+            std::string interval;
+            ss >> interval;
+
+            int bodyLine = lineNumber + 1;
+            size_t bodyBegin = pos;
+            size_t bodyEnd = skipBlock(code, pos, end, lineNumber);
+
+            statement.kind = command == "every" ? Statement::Every : Statement::After;
+            statement.condition = interval;
+            statement.body = std::make_shared<LazyBlock>(source, bodyBegin,
+                                                         bodyEnd, bodyLine);
+        }
+
+        block->statements.push_back(std::move(statement));
+    }
+
+    if (encode)
+        encodeBlock(*block);
+
+    return block;
+}
+
+inline const Block& LazyBlock::get() const {
+
+    std::call_once(parsed, [this] {
+        if (!block)
+            block = parseBlock(source, begin, end, firstLine);
+    });
+
+    return *block;
+}
+
+// ============================================
+// Parallel parsing of large scripts
+// ============================================
+// Scripts smaller than this are parsed on one thread
+static const size_t parallelParseSize = 1 << 20;
+
+// std::isspace of the "C" locale (the one this program runs in),
+// without a library call per character: --each-line splits every line
+static inline bool isSpace(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// Read one space-separated word of `line`, starting at `pos`
+static std::string_view nextWord(std::string_view line, size_t& pos) {
+
+    while (pos < line.size() && isSpace(line[pos]))
+        pos++;
+
+    size_t start = pos;
+
+    while (pos < line.size() && !isSpace(line[pos]))
+        pos++;
+
+    return line.substr(start, pos - start);
+}
+
+// Move past one top-level statement (a line, or a block header and its
+// body) without building anything. Follows the same rules as parseBlock.
+static void skipStatement(const std::string& source, size_t& pos, size_t end,
+                          int& lineNumber) {
+
+    size_t lineEnd = source.find('\n', pos);
+
+    if (lineEnd == std::string::npos || lineEnd > end)
+        lineEnd = end;
+
+    std::string_view line(source.data() + pos, lineEnd - pos);
+    pos = std::min(lineEnd + 1, end);
+    lineNumber++;
+
+    size_t wordPos = 0;
+    std::string_view command = nextWord(line, wordPos);
+
+    bool opensBlock = command == "if" || command == "while" ||
+                      command == "every" || command == "after";
+
+    if (command == "loop" || command == "ploop") {
+        nextWord(line, wordPos);
+        opensBlock = nextWord(line, wordPos) == "(";
+    }
+
+    if (opensBlock)
+        skipBlock(source, pos, end, lineNumber);
+}
+
+// Parse a whole script. A large script is cut at top-level statement
+// boundaries into one piece per core, the pieces are parsed at the same
+// time, and their statements are joined in order.
+static std::shared_ptr<const Block> parseProgram(const std::shared_ptr<const std::string>& source) {
+
+    const std::string& code = *source;
+    size_t pieces = std::thread::hardware_concurrency();
+
+    if (code.size() < parallelParseSize || pieces < 2)
+        return parseBlock(source, 0, code.size(), 1);
+
+    // Quick pass: find a statement boundary near every 1/pieces of the file
+    struct Piece {
+        size_t begin;
+        int firstLine;
+    };
+
+    std::vector<Piece> starts{ { 0, 1 } };
+    size_t pos = 0;
+    int lineNumber = 0;
+
+    while (pos < code.size()) {
+
+        skipStatement(code, pos, code.size(), lineNumber);
+
+        if (pos < code.size() && pos >= code.size() * starts.size() / pieces)
+            starts.push_back(Piece{ pos, lineNumber + 1 });
+    }
+
+    // Parse every piece on its own thread
+    std::vector<std::shared_ptr<const Block>> parts(starts.size());
+    std::vector<std::thread> threads;
+
+    for (size_t i = 0; i < starts.size(); i++) {
+
+        size_t pieceEnd = i + 1 < starts.size() ? starts[i + 1].begin : code.size();
+
+        threads.emplace_back([&, i, pieceEnd] {
+            parts[i] = parseBlock(source, starts[i].begin, pieceEnd, starts[i].firstLine, false);
+        });
+    }
+
+    for (std::thread& thread : threads)
+        thread.join();
+
+    // Join the pieces in order
+    auto block = std::make_shared<Block>();
+
+    for (const auto& part : parts)
+        block->statements.insert(block->statements.end(),
+                                 part->statements.begin(), part->statements.end());
+
+    encodeBlock(*block);
+
+    return block;
+}
+
+// ===============================
+// Incremental Reparsing
+// ===============================
+// Parses new versions of the same script, reusing every top-level
+// statement whose text did not change (including loop and if bodies
+// that were already parsed). Used by --watch and by the server.
+class IncrementalParser {
+private:
+
+    struct Parsed {
+        int firstLine;
+        std::vector<Statement> statements;  // Empty for a blank line
+    };
+
+    // Top-level statements of the last version, by their full text
+    std::map<std::string, Parsed> previous;
+
+public:
+
+    // Statements reused / parsed by the last call to parse()
+    size_t reused = 0;
+    size_t total = 0;
+
+    std::shared_ptr<const Block> parse(const std::string& code) {
+
+        auto source = std::make_shared<const std::string>(code);
+        auto block = std::make_shared<Block>();
+        std::map<std::string, Parsed> current;
+
+        size_t pos = 0;
+        int lineNumber = 0;
+
+        reused = 0;
+        total = 0;
+
+        while (pos < code.size()) {
+
+            size_t begin = pos;
+            int firstLine = lineNumber + 1;
+
+            skipStatement(code, pos, code.size(), lineNumber);
+
+            std::string text = code.substr(begin, pos - begin);
+            Parsed parsed{ firstLine, {} };
+
+            auto it = previous.find(text);
+
+            if (it != previous.end()) {
+
+                parsed.statements = it->second.statements;
+
+                // Same text on other lines: fix the line numbers; the
+                // bodies will be parsed again, with the new numbers
+                int shift = firstLine - it->second.firstLine;
+
+                if (shift != 0) {
+                    for (Statement& statement : parsed.statements) {
+                        statement.lineNumber += shift;
+                        if (statement.body)
+                            statement.body = statement.body->moved(shift);
+                    }
+                }
+
+                reused += parsed.statements.size();
+            }
+            else {
+                parsed.statements = parseBlock(source, begin, pos, firstLine, false)->statements;
+            }
+
+            total += parsed.statements.size();
+            block->statements.insert(block->statements.end(),
+                                     parsed.statements.begin(), parsed.statements.end());
+
+            current.emplace(std::move(text), std::move(parsed));
+        }
+
+        previous = std::move(current);
+
+        encodeBlock(*block);
+
+        return block;
+    }
+};
+
+// ===============================
+// Hardware Counters (--perf-counters)
+// ===============================
+// Wall time says that a loop is slow, not why. The CPU can count what
+// happened while it ran: cycles, instructions, mispredicted branches and
+// cache misses. The interpreter reads these counters every time it
+// enters or leaves a loop or if body, and charges the difference to the
+// innermost body that was running.
+//
+// In containers and virtual machines the counters are often not
+// available (or only some of them). Missing counters are shown as "-"
+// and the script still runs normally.
+
+enum PerfEvent {
+    PerfCycles,
+    PerfInstructions,
+    PerfBranchMisses,
+    PerfL1Misses,    // L1 data cache read misses
+    PerfLLCMisses,   // Last level cache misses
+    PerfEventCount
+};
+
+struct PerfSample {
+    uint64_t value[PerfEventCount] = {};
+};
+
+// Counter totals by the line of the loop or if that owns the body
+// (0 for statements outside any loop or if)
+using PerfData = std::map<int, PerfSample>;
+
+class PerfCounters {
+public:
+
+    PerfCounters() {
+#ifdef __linux__
+        static const std::pair<uint32_t, uint64_t> events[PerfEventCount] = {
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+            { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+                                  (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+        };
+
+        // All counters go in one group, so a single read() returns all
+        // of them, measured over exactly the same instructions
+        for (int i = 0; i < PerfEventCount; i++) {
+
+            perf_event_attr attr{};
+            attr.size = sizeof(attr);
+            attr.type = events[i].first;
+            attr.config = events[i].second;
+            attr.disabled = leader < 0;     // The group starts all at once
+            attr.exclude_kernel = 1;        // Only the interpreter itself
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+
+            int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+
+            if (fd < 0) {
+                if (error.empty())
+                    error = std::strerror(errno);
+                continue;
+            }
+
+            if (leader < 0)
+                leader = fd;
+
+            slot[i] = members++;
+            fds.push_back(fd);
+        }
+
+        if (leader >= 0)
+            ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#else
+        error = "not supported on this system";
+#endif
+    }
+
+    ~PerfCounters() {
+#ifdef __linux__
+        for (int fd : fds)
+            close(fd);
+#endif
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    bool available() const {
+        return members > 0;
+    }
+
+    // False if this counter could not be opened
+    bool has(int event) const {
+        return slot[event] >= 0;
+    }
+
+    // Why some or all counters are missing
+    const std::string& whyMissing() const {
+        return error;
+    }
+
+    void read(PerfSample& sample) const {
+#ifdef __linux__
+        uint64_t data[1 + PerfEventCount] = {};
+
+        if (leader < 0 || ::read(leader, data, sizeof(data)) <= 0)
+            return;
+
+        for (int i = 0; i < PerfEventCount; i++)
+            if (slot[i] >= 0)
+                sample.value[i] = data[1 + slot[i]];
+#else
+        (void)sample;
+#endif
+    }
+
+private:
+
+    int leader = -1;
+    int members = 0;
+    int slot[PerfEventCount] = { -1, -1, -1, -1, -1 };  // Position in a group read
+    std::vector<int> fds;
+    std::string error;
+};
+
+// ===============================
+// Script Files (open / readline / readint / write / close)
+// ===============================
+// ============================================
+// Read-only view of a whole file
+// ============================================
+// Uses mmap where available, so the file is paged in on demand and the
+// pages are shared (copy-on-write) with every other process using it.
+class MappedFile {
+private:
+
+    const char* bytes = nullptr;
+    size_t length = 0;
+    std::string copy;       // Used when the file can not be mapped
+
+public:
+
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+#ifndef _WIN32
+        if (bytes && copy.empty() && length > 0)
+            munmap((void*)bytes, length);
+#endif
+    }
+
+    bool open(const std::string& path) {
+
+#ifndef _WIN32
+        int fd = ::open(path.c_str(), O_RDONLY);
+
+        if (fd < 0)
+            return false;
+
+        struct stat info;
+
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+
+            void* mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+            if (mapped != MAP_FAILED) {
+                close(fd);
+                bytes = (const char*)mapped;
+                length = info.st_size;
+                return true;
+            }
+        }
+
+        close(fd);
+#endif
+
+        std::ifstream file(path, std::ios::binary);
+
+        if (!file.is_open())
+            return false;
+
+        std::stringstream buffer;
+        buffer << file.rdbuf();
+        copy = buffer.str();
+
+        bytes = copy.data();
+        length = copy.size();
+
+        return true;
+    }
+
+    // Tell the system the file is read from start to end, so it reads
+    // ahead in big chunks and drops pages that were already read
+    void sequential() const {
+#if !defined(_WIN32) && defined(MADV_SEQUENTIAL)
+        if (bytes && copy.empty() && length > 0)
+            madvise((void*)bytes, length, MADV_SEQUENTIAL);
+#endif
+    }
+
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+};
+
+// ============================================
+// Read a whole file into a string
+// ============================================
+static bool readFile(const std::string& path, std::string& contents) {
+
+    std::ifstream file(path);
+
+    if (!file.is_open())
+        return false;
+
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    contents = buffer.str();
+
+    return true;
+}
+
+// ============================================
+// A file opened by a script
+// ============================================
+// Reading walks through a mapped view of the whole file, so readline and
+// readint cost no system call at all. Writing collects the text in a
+// buffer of its own that goes to the file in large chunks (or, in a
+// ploop worker, to a shared file the parent adds in loop order).
+class ScriptFile {
+private:
+
+    // Reading
+    MappedFile input;
+    size_t pos = 0;
+    bool reading = false;
+
+    // Writing
+    std::ofstream output;
+    std::string buffer;
+    uint64_t written = 0;   // Where the next flush starts in the file
+    int divertFd = -1;      // In a ploop worker: where the lines go instead
+
+    // How it was opened, for snapshots
+    std::string path;
+    std::string mode;
+
+    static const size_t flushSize = 1 << 20;
+
+public:
+
+    ScriptFile() = default;
+    ScriptFile(const ScriptFile&) = delete;
+    ScriptFile& operator=(const ScriptFile&) = delete;
+
+    ~ScriptFile() {
+        flush();
+    }
+
+    bool openRead(const std::string& name) {
+
+        if (!input.open(name))
+            return false;
+
+        input.sequential();
+        reading = true;
+        path = name;
+        mode = "read";
+
+        return true;
+    }
+
+    bool openWrite(const std::string& name, bool append) {
+
+        output.open(name, std::ios::binary | (append ? std::ios::app : std::ios::trunc));
+
+        std::error_code error;
+        written = append ? std::filesystem::file_size(name, error) : 0;
+
+        if (error)
+            written = 0;
+
+        path = name;
+        mode = append ? "append" : "write";
+
+        return output.is_open();
+    }
+
+    // Open it again where a snapshot left it: reading continues at
+    // `offset`, writing continues after the first `offset` bytes (what
+    // came after them was written after the snapshot, so it goes).
+    bool reopen(const std::string& name, const std::string& how, uint64_t offset) {
+
+        if (how == "read")
+            return openRead(name) && offset <= input.size() && (pos = offset, true);
+
+        std::error_code error;
+
+        if (std::filesystem::file_size(name, error) < offset || error)
+            return false;
+
+        std::filesystem::resize_file(name, offset, error);
+
+        if (error || !openWrite(name, true))
+            return false;
+
+        mode = how;
+
+        return true;
+    }
+
+    const std::string& fileName() const {
+        return path;
+    }
+
+    const std::string& openMode() const {
+        return mode;
+    }
+
+    // Where reading or writing continues. Only right for writing after
+    // flush().
+    uint64_t offset() const {
+        return reading ? pos : written;
+    }
+
+    bool isReading() const {
+        return reading;
+    }
+
+    bool isWriting() const {
+        return output.is_open();
+    }
+
+    // Send the written lines to `fd` instead of the file
+    void divert(int fd) {
+        divertFd = fd;
+    }
+
+    // Add lines that were written somewhere else (by a ploop worker)
+    void append(const char* data, size_t size) {
+
+        buffer.append(data, size);
+
+        if (buffer.size() >= flushSize)
+            flush();
+    }
+
+    // The next line, without its newline. False at the end of the file.
+    bool readLine(std::string& line) {
+
+        size_t size = input.size();
+
+        if (!reading || pos >= size)
+            return false;
+
+        const char* start = input.data() + pos;
+        const char* newline = (const char*)std::memchr(start, '\n', size - pos);
+        size_t length = newline ? newline - start : size - pos;
+
+        line.assign(start, length);
+
+        // Also accept Windows line endings
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+
+        pos += length + 1;
+
+        return true;
+    }
+
+    // The next whitespace-separated word. False at the end of the file.
+    bool readWord(std::string_view& word) {
+
+        const char* data = input.data();
+        size_t size = input.size();
+
+        if (!reading)
+            return false;
+
+        while (pos < size && std::isspace((unsigned char)data[pos]))
+            pos++;
+
+        size_t start = pos;
+
+        while (pos < size && !std::isspace((unsigned char)data[pos]))
+            pos++;
+
+        word = std::string_view(data + start, pos - start);
+
+        return !word.empty();
+    }
+
+    void write(const std::string& text) {
+
+        buffer += text;
+        buffer += '\n';
+
+        if (buffer.size() >= flushSize)
+            flush();
+    }
+
+    void flush() {
+
+#ifndef _WIN32
+        if (divertFd >= 0) {
+
+            const char* data = buffer.data();
+            size_t left = buffer.size();
+
+            while (left > 0) {
+
+                ssize_t written = ::write(divertFd, data, left);
+
+                if (written < 0 && errno == EINTR)
+                    continue;
+
+                if (written <= 0)
+                    break;
+
+                data += written;
+                left -= written;
+            }
+
+            buffer.clear();
+            return;
+        }
+#endif
+
+        if (!buffer.empty() && output.is_open()) {
+            output.write(buffer.data(), buffer.size());
+            output.flush();
+            written += buffer.size();
+        }
+
+        buffer.clear();
+    }
+};
+
+// Parse a whole word as a whole number. False if it is not one
+// (or does not fit in 64 bits).
+static bool parseWholeNumber(std::string_view word, long long& value) {
+
+    size_t i = word.size() > 1 && (word[0] == '-' || word[0] == '+') ? 1 : 0;
+
+    if (i == word.size())
+        return false;
+
+    unsigned long long magnitude = 0;
+
+    for (; i < word.size(); i++) {
+
+        if (!std::isdigit((unsigned char)word[i]))
+            return false;
+
+        unsigned long long digit = word[i] - '0';
+
+        // magnitude * 10 + digit must fit
+        if (magnitude > (std::numeric_limits<unsigned long long>::max() - digit) / 10)
+            return false;
+
+        magnitude = magnitude * 10 + digit;
+    }
+
+    bool negative = word[0] == '-';
+
+    if (magnitude > (unsigned long long)std::numeric_limits<long long>::max() + negative)
+        return false;
+
+    value = negative ? (long long)(0 - magnitude) : (long long)magnitude;
+
+    return true;
+}
+
+// ============================================
+// Load columns of a CSV / TSV file (load "data.csv" cols a b c)
+// ============================================
+// Fields are separated by commas or tabs. If none of the loaded cells
+// of the first line is a number, it is taken as a header and skipped
+// (skipped columns, such as names or dates, do not count). A cell that
+// is missing or not a whole number loads as 0 and is counted in `bad`.
+//
+// The file is mapped and cut at line boundaries into one piece per
+// core; the pieces are parsed at the same time and joined in order.
+
+// Files smaller than this are loaded on one thread
+static const size_t parallelLoadSize = 1 << 20;
+
+// Position of the lowest set bit (`mask` must not be 0)
+inline int countTrailingZeros(uint32_t mask) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (int)index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+// Bit i of the result is set if p[i] is a comma, tab or newline
+inline uint32_t structuralMask(const char* p) {
+
+#if defined(__SSE2__)
+    __m128i chunk = _mm_loadu_si128((const __m128i*)p);
+    __m128i found = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(',')),
+                                              _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\t'))),
+                                 _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n')));
+
+    return (uint32_t)_mm_movemask_epi8(found);
+#else
+    uint32_t mask = 0;
+
+    for (int i = 0; i < 16; i++)
+        if (p[i] == ',' || p[i] == '\t' || p[i] == '\n')
+            mask |= 1u << i;
+
+    return mask;
+#endif
+}
+
+// The value of one cell, trimmed of spaces and quotes
+static bool parseCell(const char* begin, const char* end, long long& value) {
+
+    while (begin < end && (*begin == ' ' || *begin == '"'))
+        begin++;
+
+    while (end > begin && (end[-1] == ' ' || end[-1] == '"' || end[-1] == '\r'))
+        end--;
+
+    return parseWholeNumber(std::string_view(begin, end - begin), value);
+}
+
+// Parse the lines of [begin, end). slots[c] is where column c goes
+// (-1 for columns that are not loaded).
+template <typename Int>
+static void loadPiece(const char* begin, const char* end, const std::vector<int>& slots,
+                      size_t slotCount, std::vector<std::vector<Int>>& columns, size_t& bad) {
+
+    columns.assign(slotCount, {});
+
+    const char* fieldStart = begin;
+    size_t column = 0;
+
+    // A field ends at `fieldEnd`; `lineEnd` if it is the last of its line
+    auto endField = [&](const char* fieldEnd, bool lineEnd) {
+
+        // Empty line
+        if (lineEnd && column == 0 &&
+            (fieldEnd == fieldStart || (fieldEnd == fieldStart + 1 && *fieldStart == '\r')))
+            return;
+
+        if (column < slots.size() && slots[column] >= 0) {
+
+            long long value = 0;
+
+            if (!parseCell(fieldStart, fieldEnd, value) || (Int)value != value) {
+                value = 0;
+                bad++;
+            }
+
+            columns[slots[column]].push_back((Int)value);
+        }
+
+        column++;
+
+        if (lineEnd) {
+
+            // Short line: the missing cells are 0
+            for (; column < slots.size(); column++) {
+                if (slots[column] >= 0) {
+                    columns[slots[column]].push_back(0);
+                    bad++;
+                }
+            }
+
+            column = 0;
+        }
+    };
+
+    const char* p = begin;
+
+    // 16 bytes at a time: find every separator, then handle them in order
+    for (; p + 16 <= end; p += 16) {
+
+        for (uint32_t mask = structuralMask(p); mask != 0; mask &= mask - 1) {
+
+            const char* separator = p + countTrailingZeros(mask);
+
+            endField(separator, *separator == '\n');
+            fieldStart = separator + 1;
+        }
+    }
+
+    for (; p < end; p++) {
+        if (*p == ',' || *p == '\t' || *p == '\n') {
+            endField(p, *p == '\n');
+            fieldStart = p + 1;
+        }
+    }
+
+    // Last line without a newline
+    if (fieldStart < end || column > 0)
+        endField(end, true);
+}
+
+template <typename Int>
+static bool loadColumns(const std::string& path, const std::vector<std::string>& names,
+                        std::vector<std::vector<Int>>& columns, size_t& bad) {
+
+    MappedFile file;
+
+    if (!file.open(path))
+        return false;
+
+    file.sequential();
+
+    const char* data = file.data();
+    const char* end = data + file.size();
+
+    // Which column goes where ("_" skips a column)
+    std::vector<int> slots;
+    size_t slotCount = 0;
+
+    for (const std::string& name : names)
+        slots.push_back(name == "_" ? -1 : (int)slotCount++);
+
+    // Skip a header line: one where no loaded cell is a number
+    const char* lineEnd = (const char*)std::memchr(data, '\n', end - data);
+    const char* cell = data;
+    bool header = false;
+
+    lineEnd = lineEnd ? lineEnd : end;
+
+    for (size_t column = 0; column < slots.size() && cell <= lineEnd; column++) {
+
+        const char* cellEnd = cell;
+
+        while (cellEnd < lineEnd && *cellEnd != ',' && *cellEnd != '\t')
+            cellEnd++;
+
+        if (slots[column] >= 0) {
+
+            long long ignored;
+
+            if (parseCell(cell, cellEnd, ignored)) {
+                header = false;
+                break;
+            }
+
+            header = true;
+        }
+
+        cell = cellEnd + 1;
+    }
+
+    if (header)
+        data = lineEnd < end ? lineEnd + 1 : end;
+
+    // Cut into pieces at line boundaries
+    size_t size = end - data;
+    size_t pieces = size < parallelLoadSize ? 1 : std::max(1u, std::thread::hardware_concurrency());
+    std::vector<const char*> starts{ data };
+
+    for (size_t i = 1; i < pieces; i++) {
+
+        const char* cut = std::max(starts.back(), data + size * i / pieces);
+        const char* newline = (const char*)std::memchr(cut, '\n', end - cut);
+
+        if (!newline)
+            break;
+
+        starts.push_back(newline + 1);
+    }
+
+    std::vector<std::vector<std::vector<Int>>> parts(starts.size());
+    std::vector<size_t> partBad(starts.size(), 0);
+    std::vector<std::thread> threads;
+
+    for (size_t i = 0; i < starts.size(); i++) {
+
+        const char* pieceEnd = i + 1 < starts.size() ? starts[i + 1] : end;
+
+        auto parse = [&, i, pieceEnd] {
+            loadPiece(starts[i], pieceEnd, slots, slotCount, parts[i], partBad[i]);
+        };
+
+        if (i + 1 < starts.size())
+            threads.emplace_back(parse);
+        else
+            parse();    // The last piece runs on this thread
+    }
+
+    for (std::thread& thread : threads)
+        thread.join();
+
+    // Join the pieces, column by column
+    columns.assign(slotCount, {});
+    bad = 0;
+
+    for (size_t c = 0; c < slotCount; c++) {
+
+        size_t total = 0;
+
+        for (const auto& part : parts)
+            total += part[c].size();
+
+        columns[c].reserve(total);
+
+        for (const auto& part : parts)
+            columns[c].insert(columns[c].end(), part[c].begin(), part[c].end());
+    }
+
+    for (size_t count : partBad)
+        bad += count;
+
+    return true;
+}
+
+// ============================================
+// An array of a script
+// ============================================
+// Either in memory (load, array a 100) or backed by a file (array a
+// mapped "a.bin" 100). A file-backed array is a MAP_SHARED mapping of
+// the file: the page cache loads and evicts its pages, so it can be
+// larger than RAM, and every change goes straight to the file. The file
+// holds the elements as raw integers in the machine's byte order.
+//
+// The access pattern of a mapped array is watched, and the system is
+// told about it (madvise): a long run of i, i+1, i+2... makes it read
+// ahead, a long run of jumps makes it stop reading ahead.
+template <typename Int>
+class ScriptArray {
+private:
+
+    std::vector<Int> values;    // In-memory arrays
+    Int* mapped = nullptr;      // File-backed arrays
+    size_t mappedCount = 0;
+
+    // The whole mapping (the elements may start after a file header)
+    void* mapBase = nullptr;
+    size_t mapLength = 0;
+
+    // File of an array made by map(): its elements live there
+    std::string sharedPath;
+
+    // Access pattern of a mapped array
+    enum Advice { Normal, Sequential, Random };
+
+    static const int adviceAfter = 1024;    // Accesses in a row
+
+    size_t lastIndex = 0;
+    int sequentialRun = 0;
+    int randomRun = 0;
+    Advice advice = Normal;
+
+    void advise(Advice pattern) {
+#if !defined(_WIN32) && defined(MADV_SEQUENTIAL)
+        madvise((void*)mapped, mappedCount * sizeof(Int),
+                pattern == Sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+#endif
+        advice = pattern;
+    }
+
+public:
+
+    ScriptArray() = default;
+
+    explicit ScriptArray(std::vector<Int> elements) : values(std::move(elements)) {}
+
+    ScriptArray(ScriptArray&& other) noexcept {
+        *this = std::move(other);
+    }
+
+    ScriptArray& operator=(ScriptArray&& other) noexcept {
+        std::swap(values, other.values);
+        std::swap(mapped, other.mapped);
+        std::swap(mappedCount, other.mappedCount);
+        std::swap(mapBase, other.mapBase);
+        std::swap(mapLength, other.mapLength);
+        std::swap(sharedPath, other.sharedPath);
+        std::swap(lastIndex, other.lastIndex);
+        std::swap(sequentialRun, other.sequentialRun);
+        std::swap(randomRun, other.randomRun);
+        std::swap(advice, other.advice);
+        return *this;
+    }
+
+    ~ScriptArray() {
+#ifndef _WIN32
+        if (mapBase)
+            munmap(mapBase, mapLength);
+#endif
+    }
+
+    // Map `count` elements of the file (made longer if needed), or the
+    // whole file if count is 0. Returns an error message, empty if it
+    // worked.
+    std::string map(const std::string& path, size_t count) {
+#ifndef _WIN32
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+
+        if (fd < 0)
+            return "could not open file '" + path + "'";
+
+        struct stat info;
+
+        if (fstat(fd, &info) != 0) {
+            close(fd);
+            return "could not read file '" + path + "'";
+        }
+
+        if (count == 0)
+            count = info.st_size / sizeof(Int);
+
+        if ((size_t)info.st_size < count * sizeof(Int) &&
+            ftruncate(fd, count * sizeof(Int)) != 0) {
+            close(fd);
+            return "could not make file '" + path + "' longer";
+        }
+
+        void* memory = count > 0 ? mmap(nullptr, count * sizeof(Int), PROT_READ | PROT_WRITE,
+                                        MAP_SHARED, fd, 0)
+                                 : nullptr;
+        close(fd);
+
+        if (count > 0 && memory == MAP_FAILED)
+            return "could not map file '" + path + "'";
+
+        mapped = (Int*)memory;
+        mappedCount = count;
+        mapBase = memory;
+        mapLength = count * sizeof(Int);
+        sharedPath = path;
+
+        return "";
+#else
+        (void)path;
+        (void)count;
+        return "mapped arrays are not supported on this system";
+#endif
+    }
+
+    // Use `count` elements that start `offset` bytes into a file, as a
+    // private copy-on-write mapping: changes stay in this run and never
+    // reach the file. False if the file can not be mapped.
+    bool view(const std::string& path, size_t offset, size_t count) {
+#ifndef _WIN32
+        int fd = ::open(path.c_str(), O_RDONLY);
+
+        if (fd < 0)
+            return false;
+
+        size_t length = offset + count * sizeof(Int);
+        void* memory = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        close(fd);
+
+        if (memory == MAP_FAILED)
+            return false;
+
+        mapped = (Int*)((char*)memory + offset);
+        mappedCount = count;
+        mapBase = memory;
+        mapLength = length;
+
+        return true;
+#else
+        (void)path;
+        (void)offset;
+        (void)count;
+        return false;
+#endif
+    }
+
+    // The file of a map()ped array, or "" for any other array
+    const std::string& file() const {
+        return sharedPath;
+    }
+
+    // All elements, one after the other
+    const Int* data() const {
+        return mapped ? mapped : values.data();
+    }
+
+    size_t size() const {
+        return mapped ? mappedCount : values.size();
+    }
+
+    // Element `index` (already checked against size())
+    Int& at(size_t index) {
+
+        if (!mapped)
+            return values[index];
+
+        if (index == lastIndex + 1) {
+            randomRun = 0;
+            if (++sequentialRun == adviceAfter && advice != Sequential)
+                advise(Sequential);
+        }
+        else if (index != lastIndex) {
+            sequentialRun = 0;
+            if (++randomRun == adviceAfter && advice != Random)
+                advise(Random);
+        }
+
+        lastIndex = index;
+
+        return mapped[index];
+    }
+};
+
+// ============================================
+// Binary array files (save a "a.nanbin" / load a "a.nanbin")
+// ============================================
+// Layout (version 1), all numbers in the machine's byte order:
+//
+//   offset  size
+//        0     8  "NANBIN\0" and the version byte
+//        8     4  element size in bytes (4, or 8 with NAN_INT64)
+//       12     4  flags (1 = compressed)
+//       16     8  number of elements
+//       24     8  checksum of the element bytes (see checksumBytes)
+//       32    32  zeros
+//       64        the elements
+//
+// The elements start 64 bytes in, so an uncompressed file can be mapped
+// and used as the array right away, without reading it.
+//
+// A compressed file stores the element bytes in blocks of up to 64 KB.
+// Every block starts with its stored size (4 bytes, highest bit set if
+// the block is stored as-is because it did not get smaller) and its
+// original size (4 bytes), followed by the block in the LZ format below.
+
+static const char nanbinMagic[8] = { 'N', 'A', 'N', 'B', 'I', 'N', 0, 1 };
+static const size_t nanbinHeaderSize = 64;
+static const size_t nanbinBlockSize = 1 << 16;
+static const uint32_t nanbinCompressed = 1;
+static const uint32_t nanbinStoredBlock = 0x80000000u;
+
+struct NanbinHeader {
+    char magic[8];
+    uint32_t elementSize;
+    uint32_t flags;
+    uint64_t count;
+    uint64_t checksum;
+    char reserved[32];
+};
+
+static_assert(sizeof(NanbinHeader) == nanbinHeaderSize, "header must be 64 bytes");
+
+// FNV-1a over 8-byte words (then the last bytes one by one): much faster
+// than byte by byte, which matters for arrays of gigabytes
+static uint64_t checksumBytes(const char* data, size_t size) {
+
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i = 0;
+
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * 1099511628211ULL;
+    }
+
+    for (; i < size; i++)
+        hash = (hash ^ (unsigned char)data[i]) * 1099511628211ULL;
+
+    return hash;
+}
+
+// ============================================
+// LZ compression of one block
+// ============================================
+// The format follows LZ4 blocks: a sequence is a token byte (high 4
+// bits: number of literals, low 4 bits: match length - 4, 15 meaning
+// "more length bytes follow"), the literal bytes, and a 2-byte offset
+// back to where the match is copied from. The last sequence has only
+// literals.
+
+static void lzWriteLength(std::string& out, size_t length) {
+
+    while (length >= 255) {
+        out += (char)255;
+        length -= 255;
+    }
+
+    out += (char)length;
+}
+
+static std::string lzCompress(const char* data, size_t size) {
+
+    std::string out;
+    uint32_t table[1 << 12] = {};   // Last position of every 4-byte hash (+1)
+    size_t literalStart = 0;
+    size_t pos = 0;
+
+    auto read32 = [data](size_t at) {
+        uint32_t value;
+        std::memcpy(&value, data + at, 4);
+        return value;
+    };
+
+    // The last bytes are always literals
+    while (size >= 12 && pos + 12 <= size) {
+
+        uint32_t hash = (read32(pos) * 2654435761u) >> 20;
+        size_t candidate = table[hash];
+        table[hash] = (uint32_t)pos + 1;
+
+        if (candidate == 0 || pos - (candidate - 1) > 65535 ||
+            read32(candidate - 1) != read32(pos)) {
+            pos++;
+            continue;
+        }
+
+        size_t match = candidate - 1;
+        size_t length = 4;
+
+        while (pos + length + 5 < size && data[match + length] == data[pos + length])
+            length++;
+
+        size_t literals = pos - literalStart;
+        out += (char)((std::min<size_t>(literals, 15) << 4) | std::min<size_t>(length - 4, 15));
+
+        if (literals >= 15)
+            lzWriteLength(out, literals - 15);
+
+        out.append(data + literalStart, literals);
+
+        uint16_t offset = (uint16_t)(pos - match);
+        out += (char)(offset & 0xFF);
+        out += (char)(offset >> 8);
+
+        if (length - 4 >= 15)
+            lzWriteLength(out, length - 4 - 15);
+
+        pos += length;
+        literalStart = pos;
+    }
+
+    size_t literals = size - literalStart;
+    out += (char)(std::min<size_t>(literals, 15) << 4);
+
+    if (literals >= 15)
+        lzWriteLength(out, literals - 15);
+
+    out.append(data + literalStart, literals);
+
+    return out;
+}
+
+// Decompress exactly `size` bytes into out. False if the block is damaged.
+static bool lzDecompress(const char* in, size_t inSize, char* out, size_t size) {
+
+    size_t i = 0;
+    size_t o = 0;
+
+    auto readLength = [&](size_t length) {
+        if (length == 15) {
+            unsigned char more;
+            do {
+                if (i >= inSize)
+                    return std::numeric_limits<size_t>::max();
+                more = (unsigned char)in[i++];
+                length += more;
+            } while (more == 255);
+        }
+        return length;
+    };
+
+    while (i < inSize) {
+
+        unsigned char token = (unsigned char)in[i++];
+        size_t literals = readLength(token >> 4);
+
+        if (literals > inSize - i || literals > size - o)
+            return false;
+
+        std::memcpy(out + o, in + i, literals);
+        i += literals;
+        o += literals;
+
+        // Last sequence
+        if (i == inSize)
+            break;
+
+        if (inSize - i < 2)
+            return false;
+
+        size_t offset = (unsigned char)in[i] | (unsigned char)in[i + 1] << 8;
+        i += 2;
+
+        size_t length = readLength(token & 15);
+
+        if (length == std::numeric_limits<size_t>::max())
+            return false;
+
+        length += 4;
+
+        if (offset == 0 || offset > o || length > size - o)
+            return false;
+
+        // Byte by byte: the match may overlap what it writes
+        for (size_t k = 0; k < length; k++, o++)
+            out[o] = out[o - offset];
+    }
+
+    return o == size;
+}
+
+template <typename Int>
+static bool saveNanbin(const std::string& path, const ScriptArray<Int>& array, bool compress) {
+
+    const char* bytes = (const char*)array.data();
+    size_t size = array.size() * sizeof(Int);
+
+    NanbinHeader header{};
+    std::memcpy(header.magic, nanbinMagic, sizeof(header.magic));
+    header.elementSize = sizeof(Int);
+    header.flags = compress ? nanbinCompressed : 0;
+    header.count = array.size();
+    header.checksum = checksumBytes(bytes, size);
+
+    std::string temp = path + ".tmp";
+
+    {
+        std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+
+        if (!file.write((const char*)&header, sizeof(header)))
+            return false;
+
+        if (!compress) {
+            file.write(bytes, size);
+        }
+        else {
+            for (size_t at = 0; at < size; at += nanbinBlockSize) {
+
+                size_t blockSize = std::min(nanbinBlockSize, size - at);
+                std::string packed = lzCompress(bytes + at, blockSize);
+                bool stored = packed.size() >= blockSize;
+
+                uint32_t sizes[2] = {
+                    (uint32_t)(stored ? blockSize : packed.size()) | (stored ? nanbinStoredBlock : 0),
+                    (uint32_t)blockSize
+                };
+
+                file.write((const char*)sizes, sizeof(sizes));
+
+                if (stored)
+                    file.write(bytes + at, blockSize);
+                else
+                    file.write(packed.data(), packed.size());
+            }
+        }
+
+        if (!file)
+            return false;
+    }
+
+    return std::rename(temp.c_str(), path.c_str()) == 0;
+}
+
+// Returns an error message, empty if it worked. An uncompressed file is
+// used in place, so its checksum is only checked with `verify`: reading
+// every byte would undo the point of mapping it. A compressed file is
+// read in full anyway, so its checksum is always checked.
+template <typename Int>
+static std::string loadNanbin(const std::string& path, ScriptArray<Int>& array, bool verify) {
+
+    MappedFile file;
+
+    if (!file.open(path))
+        return "could not open file '" + path + "'";
+
+    NanbinHeader header;
+
+    if (file.size() < sizeof(header))
+        return "'" + path + "' is not a nanbin file";
+
+    std::memcpy(&header, file.data(), sizeof(header));
+
+    if (std::memcmp(header.magic, nanbinMagic, 7) != 0)
+        return "'" + path + "' is not a nanbin file";
+
+    if (header.magic[7] != nanbinMagic[7])
+        return "'" + path + "' was written by another version of nanLanguage";
+
+    if (header.elementSize != sizeof(Int))
+        return "'" + path + "' holds " + std::to_string(header.elementSize * 8) +
+               "-bit numbers (this build uses " + std::to_string(sizeof(Int) * 8) + "-bit)";
+
+    if (header.count > (file.size() * 255 + nanbinBlockSize) / sizeof(Int))
+        return "'" + path + "' is damaged";
+
+    size_t size = header.count * sizeof(Int);
+    const char* body = file.data() + sizeof(header);
+    size_t bodySize = file.size() - sizeof(header);
+
+    if (!(header.flags & nanbinCompressed)) {
+
+        if (bodySize < size || (verify && checksumBytes(body, size) != header.checksum))
+            return "'" + path + "' is damaged";
+
+        // Use the file as it is, without copying it
+        if (array.view(path, sizeof(header), header.count))
+            return "";
+
+        array = ScriptArray<Int>(std::vector<Int>((const Int*)body, (const Int*)body + header.count));
+        return "";
+    }
+
+    std::vector<Int> values(header.count);
+    char* out = (char*)values.data();
+    size_t in = 0;
+
+    for (size_t at = 0; at < size; at += nanbinBlockSize) {
+
+        uint32_t sizes[2];
+
+        if (bodySize - in < sizeof(sizes))
+            return "'" + path + "' is damaged";
+
+        std::memcpy(sizes, body + in, sizeof(sizes));
+        in += sizeof(sizes);
+
+        size_t stored = sizes[0] & ~nanbinStoredBlock;
+        size_t blockSize = std::min(nanbinBlockSize, size - at);
+
+        if (sizes[1] != blockSize || bodySize - in < stored)
+            return "'" + path + "' is damaged";
+
+        if (sizes[0] & nanbinStoredBlock) {
+            if (stored != blockSize)
+                return "'" + path + "' is damaged";
+            std::memcpy(out + at, body + in, blockSize);
+        }
+        else if (!lzDecompress(body + in, stored, out + at, blockSize)) {
+            return "'" + path + "' is damaged";
+        }
+
+        in += stored;
+    }
+
+    if (checksumBytes(out, size) != header.checksum)
+        return "'" + path + "' is damaged";
+
+    array = ScriptArray<Int>(std::move(values));
+
+    return "";
+}
+
+// ===============================
+// Text Search (find / contains / split)
+// ===============================
+// Finds `needle` in `text` 16 positions at a time: a position can only
+// be a match if both its first and its last byte are right, and SSE2
+// checks both for 16 positions with two compares. Only the (rare)
+// positions that pass are compared in full. Returns the position of the
+// first match, or std::string_view::npos.
+static size_t findText(std::string_view text, std::string_view needle) {
+
+    size_t k = needle.size();
+
+    if (k == 0)
+        return 0;
+
+    if (k > text.size())
+        return std::string_view::npos;
+
+    if (k == 1) {
+        const void* found = std::memchr(text.data(), needle[0], text.size());
+        return found ? (const char*)found - text.data() : std::string_view::npos;
+    }
+
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[k - 1]);
+
+    for (; i + k - 1 + 16 <= text.size(); i += 16) {
+
+        __m128i blockFirst = _mm_loadu_si128((const __m128i*)(text.data() + i));
+        __m128i blockLast = _mm_loadu_si128((const __m128i*)(text.data() + i + k - 1));
+
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(blockFirst, first), _mm_cmpeq_epi8(blockLast, last)));
+
+        for (; mask != 0; mask &= mask - 1) {
+
+            size_t candidate = i + countTrailingZeros(mask);
+
+            if (std::memcmp(text.data() + candidate + 1, needle.data() + 1, k - 2) == 0)
+                return candidate;
+        }
+    }
+#endif
+
+    // The last positions (or everything without SSE2)
+    size_t found = text.substr(i).find(needle);
+
+    return found == std::string_view::npos ? found : i + found;
+}
+
+// Pieces of a text, made by split. They are views into one copy of the
+// text that the array keeps, so no piece is copied on its own.
+struct TextArray {
+    std::shared_ptr<const std::string> text;
+    std::vector<std::string_view> pieces;
+};
+
+// ===============================
+// Batch File Reads (readfiles)
+// ===============================
+// Reading thousands of small files one by one spends most of the time
+// waiting: every read() is a system call that blocks until its data is
+// there. readfiles gives the system all the reads at once instead.
+//
+// On Linux the reads go through io_uring: up to 256 reads are put in a
+// shared queue and submitted with a single system call, and the kernel
+// works on all of them at the same time. The contents of all files go
+// into one buffer, registered with the kernel when the memory limit
+// allows it (so it does not have to map the pages for every read). Where
+// io_uring is not available, a few threads do blocking reads in parallel.
+//
+// Only one batch of files is open at a time, so a list of thousands of
+// files does not run into the limit on open files.
+
+// Files open (and reads in flight) at a time
+static const size_t readBatch = 256;
+
+#ifdef __linux__
+
+// A minimal io_uring: one submission and one completion queue
+class IoRing {
+private:
+
+    int fd = -1;
+
+    void* sqMemory = nullptr;
+    size_t sqSize = 0;
+    void* cqMemory = nullptr;
+    size_t cqSize = 0;
+    io_uring_sqe* sqes = nullptr;
+    size_t sqesSize = 0;
+
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned* sqMask;
+    unsigned* sqArray;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned* cqMask;
+    io_uring_cqe* cqes;
+
+    unsigned pending = 0;   // Filled in but not submitted yet
+
+public:
+
+    IoRing() = default;
+    IoRing(const IoRing&) = delete;
+    IoRing& operator=(const IoRing&) = delete;
+
+    ~IoRing() {
+        if (sqes)
+            munmap(sqes, sqesSize);
+        if (cqMemory && cqMemory != sqMemory)
+            munmap(cqMemory, cqSize);
+        if (sqMemory)
+            munmap(sqMemory, sqSize);
+        if (fd >= 0)
+            close(fd);
+    }
+
+    bool setup(unsigned entries) {
+
+        io_uring_params params{};
+        fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+
+        if (fd < 0)
+            return false;
+
+        sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+        bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+
+        if (single)
+            sqSize = cqSize = std::max(sqSize, cqSize);
+
+        sqMemory = mmap(nullptr, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        fd, IORING_OFF_SQ_RING);
+
+        if (sqMemory == MAP_FAILED) {
+            sqMemory = nullptr;
+            return false;
+        }
+
+        cqMemory = single ? sqMemory
+                          : mmap(nullptr, cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                 fd, IORING_OFF_CQ_RING);
+
+        if (cqMemory == MAP_FAILED) {
+            cqMemory = nullptr;
+            return false;
+        }
+
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        void* sqeMemory = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+
+        if (sqeMemory == MAP_FAILED)
+            return false;
+
+        sqes = (io_uring_sqe*)sqeMemory;
+
+        char* sq = (char*)sqMemory;
+        char* cq = (char*)cqMemory;
+
+        sqHead = (unsigned*)(sq + params.sq_off.head);
+        sqTail = (unsigned*)(sq + params.sq_off.tail);
+        sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+        sqArray = (unsigned*)(sq + params.sq_off.array);
+        cqHead = (unsigned*)(cq + params.cq_off.head);
+        cqTail = (unsigned*)(cq + params.cq_off.tail);
+        cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+        cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+        return true;
+    }
+
+    // Let reads use `buffer` as fixed buffer 0. False if the kernel
+    // refuses (usually because of the locked-memory limit).
+    bool registerBuffer(void* buffer, size_t size) {
+
+        iovec vector{ buffer, size };
+
+        return syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, &vector, 1) == 0;
+    }
+
+    // Queue a read of `size` bytes at `offset` of file `file` into `into`.
+    // `fixed`: `into` lies in the registered buffer.
+    void read(int file, char* into, unsigned size, uint64_t offset, uint64_t tag, bool fixed) {
+
+        unsigned tail = *sqTail;
+        unsigned index = tail & *sqMask;
+        io_uring_sqe& sqe = sqes[index];
+
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        sqe.fd = file;
+        sqe.addr = (uint64_t)(uintptr_t)into;
+        sqe.len = size;
+        sqe.off = offset;
+        sqe.buf_index = 0;
+        sqe.user_data = tag;
+
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        pending++;
+    }
+
+    // Submit what was queued and wait until all of it is done.
+    // done(tag, result) is called for every finished read.
+    template <typename Done>
+    bool submitAndWait(Done done) {
+
+        unsigned waiting = pending;
+
+        if (syscall(__NR_io_uring_enter, fd, pending, pending, IORING_ENTER_GETEVENTS,
+                    nullptr, 0) < 0)
+            return false;
+
+        pending = 0;
+
+        while (waiting > 0) {
+
+            unsigned head = *cqHead;
+
+            if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+
+                // Some reads are still running
+                if (syscall(__NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS,
+                            nullptr, 0) < 0)
+                    return false;
+                continue;
+            }
+
+            const io_uring_cqe& cqe = cqes[head & *cqMask];
+            done(cqe.user_data, cqe.res);
+
+            __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+            waiting--;
+        }
+
+        return true;
+    }
+};
+
+// Reads files first..last-1 with io_uring. False if the ring fails.
+// `fixed`: `contents` is registered with the ring.
+static bool readWithRing(IoRing& ring, bool fixed, size_t first, size_t last,
+                         const std::vector<int>& files, const std::vector<size_t>& offsets,
+                         const std::vector<size_t>& sizes, std::string& contents,
+                         std::vector<bool>& ok) {
+
+    // What is still to be read of every file (short reads are continued)
+    std::vector<size_t> done(last - first, 0);
+    std::vector<size_t> queue;
+
+    for (size_t i = first; i < last; i++)
+        if (ok[i] && sizes[i] > 0)
+            queue.push_back(i);
+
+    while (!queue.empty()) {
+
+        std::vector<size_t> again;
+        size_t count = std::min(queue.size(), readBatch);
+
+        for (size_t k = 0; k < count; k++) {
+
+            size_t i = queue[k];
+            size_t at = done[i - first];
+            size_t left = std::min<size_t>(sizes[i] - at, 1u << 30);
+
+            ring.read(files[i], &contents[offsets[i] + at], (unsigned)left, at, i, fixed);
+        }
+
+        bool submitted = ring.submitAndWait([&](uint64_t i, int result) {
+
+            if (result <= 0) {
+                ok[i] = result == 0 && done[i - first] == sizes[i];
+                return;
+            }
+
+            done[i - first] += result;
+
+            if (done[i - first] < sizes[i])
+                again.push_back(i);
+        });
+
+        if (!submitted)
+            return false;
+
+        queue.erase(queue.begin(), queue.begin() + count);
+        queue.insert(queue.end(), again.begin(), again.end());
+    }
+
+    return true;
+}
+
+#endif
+
+// Reads files first..last-1 on a few threads with plain blocking reads
+static void readWithThreads(size_t first, size_t last,
+                            const std::vector<int>& files, const std::vector<size_t>& offsets,
+                            const std::vector<size_t>& sizes, std::string& contents,
+                            std::vector<bool>& ok) {
+#ifndef _WIN32
+    // Waiting for the disk uses no CPU, so more threads than cores help
+    static const size_t readers = 8;
+
+    std::atomic<size_t> next{ first };
+    std::vector<char> failed(last - first, 0);
+
+    auto work = [&] {
+        for (size_t i = next++; i < last; i = next++) {
+
+            size_t done = 0;
+
+            while (ok[i] && done < sizes[i]) {
+
+                ssize_t got = pread(files[i], &contents[offsets[i] + done], sizes[i] - done, done);
+
+                if (got <= 0) {
+                    failed[i - first] = 1;
+                    break;
+                }
+
+                done += got;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+
+    for (size_t t = 1; t < std::min(readers, last - first); t++)
+        threads.emplace_back(work);
+
+    work();
+
+    for (std::thread& thread : threads)
+        thread.join();
+
+    for (size_t i = first; i < last; i++)
+        if (failed[i - first])
+            ok[i] = false;
+#else
+    (void)first;
+    (void)last;
+    (void)files;
+    (void)offsets;
+    (void)sizes;
+    (void)contents;
+    (void)ok;
+#endif
+}
+
+// ============================================
+// Read many files into one text array
+// ============================================
+// The contents of file i become piece i. A file that can not be read
+// gives an empty piece and is counted in `failed`.
+static TextArray readFiles(const std::vector<std::string_view>& paths, size_t& failed) {
+
+    std::vector<int> files(paths.size(), -1);
+    std::vector<size_t> offsets(paths.size(), 0);
+    std::vector<size_t> sizes(paths.size(), 0);
+    std::vector<bool> ok(paths.size(), false);
+
+    auto contents = std::make_shared<std::string>();
+    size_t total = 0;
+
+#ifndef _WIN32
+    // The sizes come first, so all contents fit in one buffer
+    for (size_t i = 0; i < paths.size(); i++) {
+
+        struct stat info;
+
+        if (stat(std::string(paths[i]).c_str(), &info) != 0 || !S_ISREG(info.st_mode))
+            continue;
+
+        ok[i] = true;
+        offsets[i] = total;
+        sizes[i] = info.st_size;
+        total += sizes[i];
+    }
+
+    contents->resize(total);
+
+#ifdef __linux__
+    IoRing ring;
+    bool useRing = ring.setup(readBatch);
+    bool fixed = useRing && total > 0 && ring.registerBuffer(contents->data(), total);
+#endif
+
+    // Open, read and close one batch of files at a time
+    for (size_t first = 0; first < paths.size(); first += readBatch) {
+
+        size_t last = std::min(first + readBatch, paths.size());
+
+        for (size_t i = first; i < last; i++) {
+
+            if (!ok[i])
+                continue;
+
+            files[i] = ::open(std::string(paths[i]).c_str(), O_RDONLY);
+
+            struct stat info;
+
+            // A file that changed size since it was measured does not fit
+            if (files[i] < 0 || fstat(files[i], &info) != 0 ||
+                (size_t)info.st_size != sizes[i])
+                ok[i] = false;
+        }
+
+        bool done = false;
+
+#ifdef __linux__
+        if (useRing) {
+            done = readWithRing(ring, fixed, first, last, files, offsets, sizes, *contents, ok);
+            useRing = done;
+        }
+#endif
+
+        if (!done)
+            readWithThreads(first, last, files, offsets, sizes, *contents, ok);
+
+        for (size_t i = first; i < last; i++)
+            if (files[i] >= 0) {
+                close(files[i]);
+                files[i] = -1;
+            }
+    }
+#else
+    // No POSIX files: read them one by one
+    std::vector<std::string> texts(paths.size());
+
+    for (size_t i = 0; i < paths.size(); i++) {
+        ok[i] = readFile(std::string(paths[i]), texts[i]);
+        offsets[i] = total;
+        sizes[i] = texts[i].size();
+        total += sizes[i];
+    }
+
+    for (const std::string& text : texts)
+        *contents += text;
+#endif
+
+    TextArray result;
+    result.text = contents;
+    failed = 0;
+
+    for (size_t i = 0; i < paths.size(); i++) {
+
+        if (ok[i]) {
+            result.pieces.push_back(std::string_view(*contents).substr(offsets[i], sizes[i]));
+        }
+        else {
+            result.pieces.push_back(std::string_view());
+            failed++;
+        }
+    }
+
+    return result;
+}
+
+// ===============================
+// Timers (sleep / every / after)
+// ===============================
+
+// ============================================
+// Hierarchical timing wheel
+// ============================================
+// Holds any number of timers with O(1) insert and cancel. Time is in
+// milliseconds. Level 0 has one slot per millisecond for the next 256
+// ms, level 1 one slot per 256 ms, and so on (4 levels cover 49 days).
+// A timer sits in the lowest level that can tell its time apart from
+// the current time; when the current time reaches the start of a
+// higher slot, the timers in it move down one level.
+template <typename T>
+class TimingWheel {
+public:
+
+    using Handle = size_t;
+    static const Handle none = (Handle)-1;
+
+    // Add a timer due at `deadline` (at least 1 ms from now)
+    Handle insert(uint64_t deadline, T value) {
+
+        Handle handle;
+
+        if (!freeNodes.empty()) {
+            handle = freeNodes.back();
+            freeNodes.pop_back();
+        }
+        else {
+            handle = nodes.size();
+            nodes.emplace_back();
+        }
+
+        Node& node = nodes[handle];
+        node.value = std::move(value);
+        node.deadline = std::max(deadline, current + 1);
+        node.used = true;
+
+        link(handle);
+        count++;
+
+        return handle;
+    }
+
+    void cancel(Handle handle) {
+
+        if (handle >= nodes.size() || !nodes[handle].used)
+            return;
+
+        unlink(handle);
+        release(handle);
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    // Drop every timer. Costs nothing when there are none.
+    void clear() {
+
+        if (count == 0)
+            return;
+
+        for (const Node& node : nodes)
+            if (node.used)
+                heads[node.slot / slots][node.slot % slots] = none;
+
+        nodes.clear();
+        freeNodes.clear();
+        count = 0;
+    }
+
+    // The earliest time a timer may be due: exact within the next 256
+    // ms, otherwise the time the next timers move down a level
+    uint64_t nextDeadline() const {
+
+        // Level 0 only holds times in the same 256 ms as the current time
+        for (uint64_t t = current + 1; t <= (current | slotMask); t++)
+            if (heads[0][t & slotMask] != none)
+                return t;
+
+        for (int level = 1; level < levels; level++) {
+
+            int shift = level * slotBits;
+            uint64_t index = (current >> shift) & slotMask;
+
+            for (uint64_t j = index + 1; j < slots; j++)
+                if (heads[level][j] != none)
+                    return ((current >> (shift + slotBits)) << (shift + slotBits)) | (j << shift);
+        }
+
+        // Only timers more than 49 days away are left
+        return ((current >> (levels * slotBits)) + 1) << (levels * slotBits);
+    }
+
+    // Move the time forward to `now`; due(value) is called for every
+    // timer that is due, in deadline order
+    template <typename Due>
+    void advance(uint64_t now, Due due) {
+
+        if (count == 0) {
+            current = std::max(current, now);
+            return;
+        }
+
+        while (current < now) {
+
+            current++;
+
+            // Move timers down from every level whose slot starts now
+            // (highest first, so they can fall through several levels)
+            int top = 0;
+
+            while (top + 1 < levels && (current & ((1ULL << ((top + 1) * slotBits)) - 1)) == 0)
+                top++;
+
+            for (int level = top; level >= 1; level--) {
+
+                Handle handle = heads[level][(current >> (level * slotBits)) & slotMask];
+                heads[level][(current >> (level * slotBits)) & slotMask] = none;
+
+                while (handle != none) {
+                    Handle next = nodes[handle].next;
+                    link(handle);
+                    handle = next;
+                }
+            }
+
+            // Everything in this millisecond's slot is due
+            Handle& head = heads[0][current & slotMask];
+
+            while (head != none) {
+                Handle handle = head;
+                unlink(handle);
+                T value = std::move(nodes[handle].value);
+                release(handle);
+                due(std::move(value));
+            }
+
+            if (count == 0) {
+                current = now;
+                return;
+            }
+        }
+    }
+
+private:
+
+    static const int levels = 4;
+    static const int slotBits = 8;
+    static const uint64_t slots = 1 << slotBits;
+    static const uint64_t slotMask = slots - 1;
+
+    struct Node {
+        T value{};
+        uint64_t deadline = 0;
+        Handle previous = none;
+        Handle next = none;
+        size_t slot = 0;            // The list it is in (level * slots + index)
+        bool used = false;
+    };
+
+    std::vector<Node> nodes;
+    std::vector<Handle> freeNodes;
+    Handle heads[levels][slots];
+    uint64_t current = 0;
+    size_t count = 0;
+
+public:
+
+    TimingWheel() {
+        for (auto& level : heads)
+            for (Handle& head : level)
+                head = none;
+    }
+
+private:
+
+    // Put a node in the slot its deadline belongs to
+    void link(Handle handle) {
+
+        Node& node = nodes[handle];
+        int level = 0;
+
+        while (level + 1 < levels &&
+               (node.deadline >> ((level + 1) * slotBits)) != (current >> ((level + 1) * slotBits)))
+            level++;
+
+        // Too far away even for the top level: wait in its last slot
+        uint64_t index = (node.deadline >> (level * slotBits)) & slotMask;
+
+        if ((node.deadline >> (levels * slotBits)) != (current >> (levels * slotBits)))
+            index = ((current >> (level * slotBits)) - 1) & slotMask;
+
+        Handle& head = heads[level][index];
+
+        node.previous = none;
+        node.next = head;
+        node.slot = level * slots + index;
+
+        if (head != none)
+            nodes[head].previous = handle;
+
+        head = handle;
+    }
+
+    void unlink(Handle handle) {
+
+        Node& node = nodes[handle];
+
+        if (node.previous != none)
+            nodes[node.previous].next = node.next;
+        else
+            heads[node.slot / slots][node.slot % slots] = node.next;
+
+        if (node.next != none)
+            nodes[node.next].previous = node.previous;
+    }
+
+    void release(Handle handle) {
+        nodes[handle].used = false;
+        nodes[handle].value = T{};
+        freeNodes.push_back(handle);
+        count--;
+    }
+};
+
+// ============================================
+// Waiting for a point in time
+// ============================================
+// On Linux one epoll instance watches a timerfd (armed for the deadline)
+// and an eventfd (so another thread can cut the wait short). Elsewhere a
+// condition variable does the same.
+class EventLoop {
+public:
+
+    using Clock = std::chrono::steady_clock;
+
+    EventLoop() {
+#ifdef __linux__
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+        wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+        for (int fd : { timerFd, wakeFd }) {
+            epoll_event event{};
+            event.events = EPOLLIN;
+            event.data.fd = fd;
+            epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+        }
+#endif
+    }
+
+    ~EventLoop() {
+#ifdef __linux__
+        for (int fd : { epollFd, timerFd, wakeFd })
+            if (fd >= 0)
+                close(fd);
+#endif
+    }
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // Wait until `deadline`, or until wake() is called
+    void waitUntil(Clock::time_point deadline) {
+#ifdef __linux__
+        // steady_clock is CLOCK_MONOTONIC on Linux
+        auto since = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            deadline.time_since_epoch()).count();
+
+        itimerspec when{};
+        when.it_value.tv_sec = std::max<long long>(since, 1) / 1000000000;
+        when.it_value.tv_nsec = std::max<long long>(since, 1) % 1000000000;
+        timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &when, nullptr);
+
+        waitForEvent();
+#else
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait_until(lock, deadline, [this] { return woken; });
+        woken = false;
+#endif
+    }
+
+    // Wait until wake() is called
+    void wait() {
+#ifdef __linux__
+        itimerspec never{};
+        timerfd_settime(timerFd, 0, &never, nullptr);
+
+        waitForEvent();
+#else
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] { return woken; });
+        woken = false;
+#endif
+    }
+
+    // Stop a wait (from any thread)
+    void wake() {
+#ifdef __linux__
+        uint64_t one = 1;
+        ssize_t written = write(wakeFd, &one, sizeof(one));
+        (void)written;
+#else
+        std::lock_guard<std::mutex> lock(mutex);
+        woken = true;
+        changed.notify_all();
+#endif
+    }
+
+private:
+
+#ifdef __linux__
+    int epollFd = -1;
+    int timerFd = -1;
+    int wakeFd = -1;
+
+    void waitForEvent() {
+
+        epoll_event events[2];
+        int ready;
+
+        do {
+            ready = epoll_wait(epollFd, events, 2, -1);
+        } while (ready < 0 && errno == EINTR);
+
+        // Clear whatever fired
+        uint64_t value;
+
+        for (int i = 0; i < ready; i++) {
+            ssize_t got = read(events[i].data.fd, &value, sizeof(value));
+            (void)got;
+        }
+    }
+#else
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool woken = false;
+#endif
+};
+
+#ifndef _WIN32
+
+// ===============================
+// Sharded Loops (--shard-procs)
+// ===============================
+// A ploop can run its iterations in forked worker processes. Each worker
+// prints into a shared-memory file of its own (a memfd on Linux), which
+// the parent copies to the real output in loop order once the worker
+// is done. Lines written to files the script had open work the same
+// way, with one shared file per worker and open file.
+
+// A new shared-memory file, or -1
+static int sharedOutputFile() {
+#ifdef __linux__
+    return memfd_create("nanLanguage-shard", MFD_CLOEXEC);
+#else
+    char path[] = "/tmp/nanLanguage-shard-XXXXXX";
+    int fd = mkstemp(path);
+
+    if (fd >= 0)
+        unlink(path);
+
+    return fd;
+#endif
+}
+
+// An output stream buffer that writes straight to a file descriptor,
+// so a worker that crashes still leaves what it printed before
+class FdOutput : public std::streambuf {
+public:
+
+    explicit FdOutput(int descriptor) : fd(descriptor) {
+        setp(buffer, buffer + sizeof(buffer));
+    }
+
+    ~FdOutput() override {
+        sync();
+    }
+
+protected:
+
+    int overflow(int c) override {
+
+        if (sync() != 0)
+            return traits_type::eof();
+
+        if (c != traits_type::eof()) {
+            *pptr() = (char)c;
+            pbump(1);
+        }
+
+        return traits_type::not_eof(c);
+    }
+
+    int sync() override {
+
+        const char* data = pbase();
+        size_t left = pptr() - pbase();
+
+        while (left > 0) {
+
+            ssize_t written = write(fd, data, left);
+
+            if (written < 0 && errno == EINTR)
+                continue;
+
+            if (written <= 0)
+                return -1;
+
+            data += written;
+            left -= written;
+        }
+
+        setp(buffer, buffer + sizeof(buffer));
+
+        return 0;
+    }
+
+private:
+
+    int fd;
+    char buffer[1 << 16];
+};
+
+// Pass everything a worker wrote into its shared file to use(data, size)
+template <typename Use>
+static void copySharedOutput(int fd, Use use) {
+
+    struct stat info;
+
+    if (fstat(fd, &info) != 0 || info.st_size == 0)
+        return;
+
+    void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+    if (data == MAP_FAILED)
+        return;
+
+    use((const char*)data, (size_t)info.st_size);
+    munmap(data, info.st_size);
+}
+
+#endif
+
+// ===============================
+// Runtime Policies
+// ===============================
+// The interpreter is a template on a policy that picks the integer type
+// of variables and which safety checks are compiled in. A check that is
+// turned off is removed by the compiler (if constexpr), so it costs
+// nothing at run time.
+template <typename IntType, bool DivisionCheck, bool OverflowCheck>
+struct RuntimePolicy {
+
+    using Int = IntType;
+
+    // div x 0 prints an error instead of crashing
+    static constexpr bool checkDivision = DivisionCheck;
+
+    // add/sub/mult/div print an error instead of wrapping around
+    static constexpr bool checkOverflow = OverflowCheck;
+};
+
+// The policy of this build:
+//   -DNAN_INT64            64-bit variables (default: 32-bit)
+//   -DNAN_CHECK_OVERFLOW   report arithmetic overflow
+//   -DNAN_UNCHECKED        no division-by-zero check (only for trusted scripts)
+#ifdef NAN_INT64
+using SelectedInt = int64_t;
+#else
+using SelectedInt = int32_t;
+#endif
+
+#ifdef NAN_UNCHECKED
+constexpr bool selectedDivisionCheck = false;
+#else
+constexpr bool selectedDivisionCheck = true;
+#endif
+
+#ifdef NAN_CHECK_OVERFLOW
+constexpr bool selectedOverflowCheck = true;
+#else
+constexpr bool selectedOverflowCheck = false;
+#endif
+
+using SelectedPolicy = RuntimePolicy<SelectedInt, selectedDivisionCheck, selectedOverflowCheck>;
+
+// ===============================
+// Simple Interpreter Class
+// ===============================
+template <typename Policy>
+class BasicInterpreter {
+public:
+
+    // Type of every variable
+    using Int = typename Policy::Int;
+
+private:
+
+    // Map to store variables
+    // Example:
+    // set x = 5
+    // This will store: variables["x"] = 5
+    std::map<std::string, Int> variables;
+
+    // Where print and error messages go (std::cout by default)
+    std::ostream* out = &std::cout;
+
+    // The program being run. Kept alive here because the frames
+    // below point into it.
+    std::shared_ptr<const Block> program;
+
+    // One frame per block that is currently running.
+    // The innermost block is at the back.
+    struct Frame {
+        const Block* block;
+        size_t pc = 0;                     // Next statement to run
+        const Statement* loop = nullptr;   // Owning loop or while (nullptr for if/top level)
+        int iteration = 0;                 // Current loop iteration
+    };
+
+    std::vector<Frame> frames;
+
+    // Text variables (filled by readline)
+    std::map<std::string, std::string> texts;
+
+    // Files opened with "open", by handle name
+    std::map<std::string, std::unique_ptr<ScriptFile>> files;
+
+    // Arrays (see ScriptArray), and arrays of texts made by split
+    std::map<std::string, ScriptArray<Int>> arrays;
+    std::map<std::string, TextArray> textArrays;
+
+    // Where loop and if counts go (see setProfile), or nullptr
+    ProfileData* profile = nullptr;
+
+    // Hardware counters (see setPerfCounters), or nullptr
+    const PerfCounters* perf = nullptr;
+    PerfData* perfData = nullptr;
+    PerfSample perfLast;
+
+    // Checkpoints (see setCheckpoint)
+    std::string checkpointPath;
+    std::string checkpointSource;
+    long checkpointEvery = 0;       // 0 = only on the checkpoint command
+    long sinceCheckpoint = 0;       // Statements run since the last one
+    bool checkpointRequested = false;
+#ifndef _WIN32
+    pid_t checkpointWriter = -1;    // Process still writing the last one
+#endif
+
+    // Timers made by every / after, and sleeps. Times are milliseconds
+    // since the interpreter was made. A timer body runs when the frames
+    // above `floor` are done: after the script ends, or while it sleeps.
+    struct Timer {
+        const Statement* statement = nullptr;
+        uint64_t deadline = 0;
+        uint64_t period = 0;        // 0 for after
+    };
+
+    // A sleeping frame stack: frames up to `floor` wait until `until`
+    struct Sleep {
+        uint64_t until;
+        size_t previousFloor;
+    };
+
+    // A timer body that is running, and the handle of its next run
+    struct RunningTimer {
+        size_t frame;
+        typename TimingWheel<Timer>::Handle next;
+    };
+
+    std::chrono::steady_clock::time_point timeBase = std::chrono::steady_clock::now();
+    TimingWheel<Timer> timers;
+    std::deque<Timer> dueTimers;
+    std::vector<Sleep> sleeps;
+    std::vector<RunningTimer> runningTimers;
+    size_t floor = 0;
+    bool waiting = false;
+    std::unique_ptr<EventLoop> eventLoop;   // Made on first wait
+
+    // Worker processes for a ploop (see setShardProcesses)
+    int shardProcesses = 1;
+
+    static constexpr const char* snapshotMagic = "NANSNAP1";
+    static constexpr const char* warmMagic = "NANWARM1";
+
+public:
+
+    // ============================================
+    // Parse a full script into a block tree
+    // ============================================
+    static std::shared_ptr<const Block> compile(const std::string& code) {
+
+        auto source = std::make_shared<const std::string>(code);
+
+        return parseProgram(source);
+    }
+
+    // ============================================
+    // Send output somewhere other than std::cout
+    // ============================================
+    void setOutput(std::ostream& stream) {
+        out = &stream;
+    }
+
+    // ============================================
+    // Count how often every loop and if runs
+    // ============================================
+    void setProfile(ProfileData* data) {
+        profile = data;
+    }
+
+    // ============================================
+    // Charge hardware counters to loop and if bodies
+    // ============================================
+    void setPerfCounters(const PerfCounters* counters, PerfData* data) {
+        perf = counters;
+        perfData = data;
+    }
+
+    // ============================================
+    // Run ploop iterations in worker processes
+    // ============================================
+    // Every ploop is cut into `count` ranges of iterations, each run by a
+    // forked copy of the interpreter. 1 (the default) runs it like loop.
+    void setShardProcesses(int count) {
+        shardProcesses = std::max(count, 1);
+    }
+
+    // ============================================
+    // Give a variable a value before the script runs
+    // ============================================
+    // Used for parameters passed with --param name=value
+    void setVariable(const std::string& name, Int value) {
+        texts.erase(name);
+        variables[name] = value;
+    }
+
+    // Give a text variable a value (see --each-line)
+    void setText(const std::string& name, std::string_view value) {
+        variables.erase(name);
+        texts[name].assign(value.data(), value.size());
+    }
+
+    // All variables and their current values
+    const std::map<std::string, Int>& getVariables() const {
+        return variables;
+    }
+
+    // ============================================
+    // Read a number written in a script
+    // ============================================
+    // Throws std::invalid_argument / std::out_of_range like std::stoi
+    static Int toInt(const std::string& text) {
+
+        if constexpr (sizeof(Int) <= sizeof(int))
+            return (Int)std::stoi(text);
+        else
+            return (Int)std::stoll(text);
+    }
+
+    // ============================================
+    // Prepare a parsed program to run from the start
+    // ============================================
+    void load(std::shared_ptr<const Block> code) {
+        program = std::move(code);
+        frames.clear();
+        frames.push_back(Frame{ program.get() });
+
+        // Timers point into the old program
+        timers.clear();
+        dueTimers.clear();
+        sleeps.clear();
+        runningTimers.clear();
+        floor = 0;
+    }
+
+    // Run the loaded program again from the start (see --each-line).
+    // Cheaper than load(): the program is not handed over again and the
+    // timer state is only cleared when the last run left some.
+    void restart() {
+        frames.clear();
+        frames.push_back(Frame{ program.get() });
+
+        if (!timers.empty() || !dueTimers.empty() || !sleeps.empty() || !runningTimers.empty()) {
+            timers.clear();
+            dueTimers.clear();
+            sleeps.clear();
+            runningTimers.clear();
+        }
+
+        floor = 0;
+    }
+
+    // ============================================
+    // Enable checkpoints
+    // ============================================
+    // A checkpoint saves the whole running state into `path`, either when
+    // the script runs the checkpoint command or every `every` statements.
+    // `source` is the script text; it is stored in the snapshot so that
+    // resume() can rebuild the program.
+    void setCheckpoint(const std::string& path, const std::string& source, long every) {
+        checkpointPath = path;
+        checkpointSource = source;
+        checkpointEvery = every;
+    }
+
+    // ============================================
+    // Encode the running state as a snapshot
+    // ============================================
+    // Layout: magic, script source, stdout offset, frames (pc and loop
+    // iteration; which block each frame runs follows from the frame
+    // before it), variables, arrays (see writeArrays), text variables,
+    // then open files (see writeOpenFiles).
+    std::string saveState(const OutputPosition& output) const {
+
+        BinaryWriter writer;
+
+        writer.data = snapshotMagic;
+        writer.text(checkpointSource);
+        writer.signedNumber(output.offset);
+        writer.number(output.device);
+        writer.number(output.inode);
+
+        writer.number(frames.size());
+        for (const Frame& frame : frames) {
+            writer.number(frame.pc);
+            writer.signedNumber(frame.iteration);
+        }
+
+        writer.number(variables.size());
+        for (const auto& variable : variables) {
+            writer.text(variable.first);
+            writer.signedNumber(variable.second);
+        }
+
+        writeArrays(writer);
+        writeTexts(writer);
+        writeOpenFiles(writer);
+
+        return writer.data;
+    }
+
+    // ============================================
+    // Continue from a snapshot made by saveState
+    // ============================================
+    // Returns false if the snapshot is damaged. On success the program is
+    // loaded and run() continues where the checkpoint was taken; `source`
+    // and `output` receive what was stored with it.
+    bool restoreState(const std::string& snapshot, std::string& source,
+                      OutputPosition& output) {
+
+        size_t magicSize = std::string(snapshotMagic).size();
+
+        if (snapshot.compare(0, magicSize, snapshotMagic) != 0)
+            return false;
+
+        BinaryReader reader(snapshot.data() + magicSize, snapshot.size() - magicSize);
+
+        source = reader.text();
+        output.offset = reader.signedNumber();
+        output.device = reader.number();
+        output.inode = reader.number();
+
+        if (!reader.ok)
+            return false;
+
+        load(compile(source));
+        frames.clear();
+
+        uint64_t frameCount = reader.number();
+
+        for (uint64_t i = 0; i < frameCount && reader.ok; i++) {
+
+            Frame frame{ program.get() };
+
+            // Inner frames run the body of the statement their parent
+            // frame has just entered
+            if (i > 0) {
+                const Frame& parent = frames.back();
+
+                if (parent.pc == 0 || parent.pc > parent.block->statements.size())
+                    return false;
+
+                const Statement& owner = parent.block->statements[parent.pc - 1];
+
+                if (!owner.body)
+                    return false;
+
+                frame.block = &owner.body->get();
+
+                if (owner.kind == Statement::Loop || owner.kind == Statement::Ploop ||
+                    owner.kind == Statement::While)
+                    frame.loop = &owner;
+            }
+
+            frame.pc = reader.number();
+            frame.iteration = (int)reader.signedNumber();
+
+            if (frame.pc > frame.block->statements.size())
+                return false;
+
+            frames.push_back(frame);
+        }
+
+        uint64_t variableCount = reader.number();
+
+        for (uint64_t i = 0; i < variableCount && reader.ok; i++) {
+            std::string name = reader.text();
+            variables[name] = (Int)reader.signedNumber();
+        }
+
+        return readArrays(reader) && readTexts(reader) && readOpenFiles(reader);
+    }
+
+    // ============================================
+    // Warm-start snapshots
+    // ============================================
+    // A warm snapshot holds variables, arrays and text variables. It is
+    // made after running a setup script, and later runs start from it
+    // instead of repeating the setup. Files are not kept: a handle that
+    // is still open is saved as closed (0). Layout: magic, variable
+    // count, name and value pairs, arrays (see writeArrays), then text
+    // variables (see writeTexts).
+    std::string saveVariables() const {
+
+        BinaryWriter writer;
+
+        writer.data = warmMagic;
+        writer.number(variables.size());
+
+        for (const auto& variable : variables) {
+            writer.text(variable.first);
+            writer.signedNumber(files.count(variable.first) ? 0 : variable.second);
+        }
+
+        writeArrays(writer);
+        writeTexts(writer);
+
+        return writer.data;
+    }
+
+    // Read the variables straight from the snapshot bytes (usually a
+    // mapped file). Returns false if the snapshot is damaged.
+    bool loadVariables(const char* data, size_t size) {
+
+        size_t magicSize = std::string(warmMagic).size();
+
+        if (size < magicSize || std::string(data, magicSize) != warmMagic)
+            return false;
+
+        BinaryReader reader(data + magicSize, size - magicSize);
+
+        uint64_t count = reader.number();
+
+        for (uint64_t i = 0; i < count && reader.ok; i++) {
+            std::string name = reader.text();
+            variables[name] = (Int)reader.signedNumber();
+        }
+
+        return readArrays(reader) && readTexts(reader);
+    }
+
+private:
+
+    // ============================================
+    // Integer arrays in snapshots
+    // ============================================
+    // Layout: array count, then for each one its name, its file ("" if
+    // it is not mapped) and its size, and the elements of arrays that
+    // are not mapped. A mapped array is mapped again from its file, which
+    // already holds its elements. Arrays of texts (split) are not saved.
+    void writeArrays(BinaryWriter& writer) const {
+
+        writer.number(arrays.size());
+
+        for (const auto& entry : arrays) {
+
+            const ScriptArray<Int>& array = entry.second;
+
+            writer.text(entry.first);
+            writer.text(array.file());
+            writer.number(array.size());
+
+            if (array.file().empty())
+                for (size_t i = 0; i < array.size(); i++)
+                    writer.signedNumber(array.data()[i]);
+        }
+    }
+
+    // Snapshots written before arrays were saved simply end earlier
+    bool readArrays(BinaryReader& reader) {
+
+        if (!reader.ok || reader.pos == reader.end)
+            return reader.ok;
+
+        uint64_t count = reader.number();
+
+        for (uint64_t i = 0; i < count && reader.ok; i++) {
+
+            std::string name = reader.text();
+            std::string path = reader.text();
+            uint64_t size = reader.number();
+
+            if (!path.empty()) {
+
+                ScriptArray<Int> array;
+                std::string error = array.map(path, size);
+
+                if (!error.empty())
+                    *out << "Warning: array '" << name << "' not restored: " << error << "\n";
+                else
+                    arrays[name] = std::move(array);
+
+                continue;
+            }
+
+            // Never trust the stored size for the allocation
+            std::vector<Int> values;
+
+            for (uint64_t j = 0; j < size && reader.ok; j++)
+                values.push_back((Int)reader.signedNumber());
+
+            arrays[name] = ScriptArray<Int>(std::move(values));
+        }
+
+        return reader.ok;
+    }
+
+    // ============================================
+    // Text variables and open files in snapshots
+    // ============================================
+    // Texts: count, then name and text pairs. Files: count, then for
+    // each one its handle, path, mode (read, write or append) and the
+    // offset where it continues. Snapshots from before these were saved
+    // end earlier.
+    void writeTexts(BinaryWriter& writer) const {
+
+        writer.number(texts.size());
+
+        for (const auto& text : texts) {
+            writer.text(text.first);
+            writer.text(text.second);
+        }
+    }
+
+    bool readTexts(BinaryReader& reader) {
+
+        if (!reader.ok || reader.pos == reader.end)
+            return reader.ok;
+
+        uint64_t count = reader.number();
+
+        for (uint64_t i = 0; i < count && reader.ok; i++) {
+            std::string name = reader.text();
+            variables.erase(name);
+            texts[name] = reader.text();
+        }
+
+        return reader.ok;
+    }
+
+    // Files that are written must be flushed first (see writeCheckpoint)
+    void writeOpenFiles(BinaryWriter& writer) const {
+
+        writer.number(files.size());
+
+        for (const auto& file : files) {
+            writer.text(file.first);
+            writer.text(file.second->fileName());
+            writer.text(file.second->openMode());
+            writer.number(file.second->offset());
+        }
+    }
+
+    bool readOpenFiles(BinaryReader& reader) {
+
+        if (!reader.ok || reader.pos == reader.end)
+            return reader.ok;
+
+        uint64_t count = reader.number();
+
+        for (uint64_t i = 0; i < count && reader.ok; i++) {
+
+            std::string handle = reader.text();
+            std::string path = reader.text();
+            std::string mode = reader.text();
+            uint64_t offset = reader.number();
+
+            auto file = std::make_unique<ScriptFile>();
+
+            if (!reader.ok)
+                break;
+
+            // The handle reads as closed, so "while f == 1" loops end
+            if (!file->reopen(path, mode, offset)) {
+                *out << "Warning: file '" << handle << "' not restored: could not open '"
+                     << path << "' where it was\n";
+                variables[handle] = 0;
+                continue;
+            }
+
+            files[handle] = std::move(file);
+        }
+
+        return reader.ok;
+    }
+
+public:
+
+    // ============================================
+    // Run the loaded program for a limited time
+    // ============================================
+    // Every statement uses one unit of fuel. When the fuel runs out the
+    // interpreter stops at the next loop back-edge (the jump from the
+    // end of a loop body to its next iteration) and returns false.
+    // Calling run() again resumes exactly where it stopped, on any
+    // thread. A negative fuel means "run until the end".
+    // Returns true when the whole program has finished, including its
+    // timers. With fuel, run() also returns false while the script only
+    // waits (sleep, or timers that are not due yet): see isWaiting().
+    // Without fuel it waits itself.
+    bool run(long fuel = -1) {
+
+        // Time spent outside run() (between slices) is not charged
+        if (perf)
+            perf->read(perfLast);
+
+        waiting = false;
+
+        while (true) {
+
+            if (!runFrames(fuel))
+                return false;
+
+            // Timer bodies that ended
+            while (!runningTimers.empty() && runningTimers.back().frame >= frames.size())
+                runningTimers.pop_back();
+
+            if (sleeps.empty() && timers.empty() && dueTimers.empty())
+                break;
+
+            timers.advance(now(), [this](Timer timer) {
+                dueTimers.push_back(timer);
+            });
+
+            // Run the next due timer body on top of the frames
+            if (!dueTimers.empty()) {
+                startTimer(dueTimers.front());
+                dueTimers.pop_front();
+                continue;
+            }
+
+            // Wake up from the innermost sleep
+            if (!sleeps.empty() && now() >= sleeps.back().until) {
+                floor = sleeps.back().previousFloor;
+                sleeps.pop_back();
+                continue;
+            }
+
+            // Nothing to do before wakeTime()
+            if (fuel >= 0) {
+                waiting = true;
+                return false;
+            }
+
+            if (!eventLoop)
+                eventLoop = std::make_unique<EventLoop>();
+
+            eventLoop->waitUntil(wakeTime());
+        }
+
+        finishCheckpoint();
+
+        return true;
+    }
+
+    // ============================================
+    // Waiting for time to pass
+    // ============================================
+    // True when the last run() stopped because the script only waits for
+    // a sleep or a timer; run() again at wakeTime() (or later).
+    bool isWaiting() const {
+        return waiting;
+    }
+
+    std::chrono::steady_clock::time_point wakeTime() const {
+
+        uint64_t next = UINT64_MAX;
+
+        if (!sleeps.empty())
+            next = sleeps.back().until;
+
+        if (!timers.empty())
+            next = std::min(next, timers.nextDeadline());
+
+        if (!dueTimers.empty() || next == UINT64_MAX)
+            return std::chrono::steady_clock::now();
+
+        return timeBase + std::chrono::milliseconds(next);
+    }
+
+    // ============================================
+    // Execute full script (multiple lines of code)
+    // ============================================
+    void execute(const std::string& code) {
+        load(compile(code));
+        run();
+    }
+
+
+private:
+
+    // ============================================
+    // Run the frames above the floor until they are done
+    // ============================================
+    // Returns false if the fuel ran out first
+    bool runFrames(long& fuel) {
+
+        while (frames.size() > floor) {
+
+            // Between two statements the state is complete, so this is
+            // where checkpoints are taken
+            if (checkpointRequested ||
+                (checkpointEvery > 0 && sinceCheckpoint >= checkpointEvery))
+                writeCheckpoint();
+
+            Frame& frame = frames.back();
+
+            // End of the block: either repeat the loop or leave it
+            if (frame.pc == frame.block->statements.size()) {
+
+                if (frame.loop && repeatLoop(frame)) {
+
+                    frame.pc = 0;
+
+                    // Back-edge: give the thread back if our slice is used up
+                    if (fuel == 0) {
+                        if (perf)
+                            chargePerf();
+                        return false;
+                    }
+
+                    if (frame.loop->straight)
+                        runStraight(frame, fuel);
+
+                    continue;
+                }
+
+                if (perf)
+                    chargePerf();
+
+                frames.pop_back();
+                continue;
+            }
+
+            const Block& block = *frame.block;
+            const Statement& statement = block.statements[frame.pc++];
+
+            if (fuel > 0)
+                fuel--;
+
+            sinceCheckpoint++;
+
+            switch (statement.kind) {
+
+            case Statement::Ploop:
+                if (shardProcesses > 1 && statement.loopCount > 1) {
+                    runShards(statement);
+                    break;
+                }
+                [[fallthrough]];
+
+            case Statement::Loop:
+                if (profile) {
+                    ProfileCounters& counters = (*profile)[&statement];
+                    counters.entries++;
+                    counters.taken += std::max(statement.loopCount, 0);
+                }
+
+                if (statement.loopCount > 0) {
+                    if (perf)
+                        chargePerf();
+
+                    variables[statement.loopVar] = 0;
+                    frames.push_back(Frame{ &statement.body->get(), 0, &statement, 0 });
+
+                    if (statement.straight)
+                        runStraight(frames.back(), fuel);
+                }
+                break;
+
+            case Statement::If: {
+                bool taken = evaluateCondition(statement.condition);
+
+                if (profile) {
+                    ProfileCounters& counters = (*profile)[&statement];
+                    counters.entries++;
+                    counters.taken += taken;
+                }
+
+                if (taken) {
+                    if (perf)
+                        chargePerf();
+
+                    frames.push_back(Frame{ &statement.body->get() });
+                }
+                break;
+            }
+
+            case Statement::While: {
+                bool taken = evaluateCondition(statement.condition);
+
+                if (profile) {
+                    ProfileCounters& counters = (*profile)[&statement];
+                    counters.entries++;
+                    counters.taken += taken;
+                }
+
+                if (taken) {
+                    if (perf)
+                        chargePerf();
+
+                    frames.push_back(Frame{ &statement.body->get(), 0, &statement, 0 });
+                }
+                break;
+            }
+
+            case Statement::Every:
+            case Statement::After: {
+                Int milliseconds;
+
+                if (valueOf(statement.condition, milliseconds))
+                    addTimer(statement, milliseconds);
+                break;
+            }
+
+            case Statement::BadLoop:
+                reportBadLoop();
+                break;
+
+            case Statement::Line:
+                runInstruction(block, statement);
+                break;
+            }
+        }
+
+        return true;
+    }
+
+    // ============================================
+    // ploop in worker processes
+    // ============================================
+    // The forked workers share the parsed program (copy-on-write) and
+    // start with a copy of every variable. What they print, and the lines
+    // they write to files that were open before the loop, come back in
+    // loop order; changes they make to variables do not.
+    NAN_COLD void runShards(const Statement& statement) {
+
+        if (profile) {
+            ProfileCounters& counters = (*profile)[&statement];
+            counters.entries++;
+            counters.taken += statement.loopCount;
+        }
+
+#ifdef _WIN32
+        // No fork(): run it as a normal loop
+        variables[statement.loopVar] = 0;
+        frames.push_back(Frame{ &statement.body->get(), 0, &statement, 0 });
+#else
+        // Parse the whole body now, so the workers do not each parse it
+        parseAll(statement.body->get());
+
+        // Anything still buffered would otherwise be written by every worker
+        out->flush();
+
+        for (auto& file : files)
+            file.second->flush();
+
+        struct Shard {
+            pid_t pid;
+            int output;
+            std::vector<int> writes;    // One per file in `writers`
+        };
+
+        std::vector<ScriptFile*> writers;
+
+        for (auto& file : files)
+            if (file.second->isWriting())
+                writers.push_back(file.second.get());
+
+        int count = std::min(shardProcesses, statement.loopCount);
+        std::vector<Shard> shards;
+        bool started = true;
+
+        for (int i = 0; i < count && started; i++) {
+
+            int begin = (int)((long long)statement.loopCount * i / count);
+            int end = (int)((long long)statement.loopCount * (i + 1) / count);
+
+            Shard shard{ -1, sharedOutputFile(), {} };
+            bool ready = shard.output >= 0;
+
+            for (size_t k = 0; k < writers.size() && ready; k++) {
+                shard.writes.push_back(sharedOutputFile());
+                ready = shard.writes.back() >= 0;
+            }
+
+            if (ready)
+                shard.pid = fork();
+
+            if (shard.pid == 0)
+                runShard(statement, begin, end, shard.output, writers, shard.writes);
+
+            started = shard.pid > 0;
+            shards.push_back(std::move(shard));
+        }
+
+        // A worker that can not start would leave its iterations out:
+        // stop the others and run the whole loop here instead
+        if (!started) {
+
+            for (Shard& shard : shards) {
+
+                if (shard.pid > 0) {
+                    kill(shard.pid, SIGKILL);
+                    waitpid(shard.pid, nullptr, 0);
+                }
+
+                if (shard.output >= 0)
+                    close(shard.output);
+
+                for (int fd : shard.writes)
+                    if (fd >= 0)
+                        close(fd);
+            }
+
+            std::cerr << "Warning: could not start the workers of ploop on line "
+                      << statement.lineNumber << "; running it in this process\n";
+
+            variables[statement.loopVar] = 0;
+            frames.push_back(Frame{ &statement.body->get(), 0, &statement, 0 });
+            return;
+        }
+
+        // Collect the output in order; a worker that failed only loses
+        // its own iterations
+        for (int i = 0; i < count; i++) {
+
+            int status = 0;
+            bool ok = shards[i].pid > 0 &&
+                      waitpid(shards[i].pid, &status, 0) == shards[i].pid &&
+                      WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+            if (shards[i].output >= 0) {
+                copySharedOutput(shards[i].output, [&](const char* data, size_t size) {
+                    out->write(data, size);
+                });
+                close(shards[i].output);
+            }
+
+            for (size_t k = 0; k < shards[i].writes.size(); k++) {
+
+                int fd = shards[i].writes[k];
+
+                if (fd < 0)
+                    continue;
+
+                copySharedOutput(fd, [&](const char* data, size_t size) {
+                    writers[k]->append(data, size);
+                });
+                close(fd);
+            }
+
+            if (!ok)
+                reportShard(i, statement.lineNumber);
+        }
+
+        // Like after a loop
+        variables[statement.loopVar] = statement.loopCount - 1;
+#endif
+    }
+
+#ifndef _WIN32
+    // In a worker: run iterations [begin, end) of the ploop, then exit
+    [[noreturn]] void runShard(const Statement& statement, int begin, int end, int output,
+                               const std::vector<ScriptFile*>& writers,
+                               const std::vector<int>& writes) {
+
+        FdOutput buffer(output);
+        std::ostream stream(&buffer);
+
+        out = &stream;
+
+        for (size_t k = 0; k < writers.size(); k++)
+            writers[k]->divert(writes[k]);
+
+        // The same loop, stopping at `end`
+        Statement range = statement;
+        range.kind = Statement::Loop;
+        range.loopCount = end;
+
+        // Only the ploop body runs here; timers stay with the parent
+        load(program);
+        frames.back() = Frame{ &statement.body->get(), 0, &range, begin };
+        variables[statement.loopVar] = begin;
+
+        shardProcesses = 1;
+        checkpointPath.clear();
+        checkpointEvery = 0;
+        checkpointWriter = -1;
+        profile = nullptr;
+        perf = nullptr;
+
+        run();
+
+        stream.flush();
+
+        for (auto& file : files)
+            file.second->flush();
+
+        _exit(0);
+    }
+#endif
+
+    NAN_COLD void reportShard(int shard, int lineNumber) {
+        *out << "Error: worker " << shard << " of ploop on line " << lineNumber << " failed\n";
+    }
+
+    // Parse every nested body of a block
+    static void parseAll(const Block& block) {
+        for (const Statement& statement : block.statements)
+            if (statement.body)
+                parseAll(statement.body->get());
+    }
+
+    // ============================================
+    // Timers and sleeps
+    // ============================================
+    uint64_t now() const {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - timeBase).count();
+    }
+
+    NAN_COLD void addTimer(const Statement& statement, Int milliseconds) {
+
+        uint64_t period = (uint64_t)std::max<Int>(milliseconds, 1);
+        uint64_t deadline = now() + period;
+
+        if (statement.kind == Statement::After)
+            period = 0;
+
+        timers.insert(deadline, Timer{ &statement, deadline, period });
+    }
+
+    // Push the body of a due timer; an every timer is first put back
+    // for its next run, so the body can stop it
+    NAN_COLD void startTimer(const Timer& timer) {
+
+        auto next = TimingWheel<Timer>::none;
+
+        if (timer.period > 0) {
+
+            // Keep the rhythm, but do not catch up on missed runs
+            uint64_t deadline = timer.deadline + timer.period;
+
+            if (deadline <= now())
+                deadline = now() + timer.period;
+
+            next = timers.insert(deadline, Timer{ timer.statement, deadline, timer.period });
+        }
+
+        runningTimers.push_back(RunningTimer{ frames.size(), next });
+        frames.push_back(Frame{ &timer.statement->body->get() });
+    }
+
+    // stop: cancel the every timer whose body is running
+    NAN_COLD void stopTimer() {
+
+        if (runningTimers.empty()) {
+            reportError("stop is only allowed inside every");
+            return;
+        }
+
+        timers.cancel(runningTimers.back().next);
+        runningTimers.back().next = TimingWheel<Timer>::none;
+    }
+
+    // sleep: the frames that are running now wait; timer bodies can run
+    // on top of them in the meantime
+    NAN_COLD void startSleep(Int milliseconds) {
+        sleeps.push_back(Sleep{ now() + (uint64_t)std::max<Int>(milliseconds, 0), floor });
+        floor = frames.size();
+    }
+
+    // ============================================
+    // End of a loop or while body: go around again?
+    // ============================================
+    bool repeatLoop(Frame& frame) {
+
+        if (frame.loop->kind == Statement::While)
+            return evaluateCondition(frame.loop->condition);
+
+        if (++frame.iteration >= frame.loop->loopCount)
+            return false;
+
+        variables[frame.loop->loopVar] = frame.iteration;
+
+        return true;
+    }
+
+    // ============================================
+    // Run whole iterations of a straight loop body
+    // ============================================
+    // `frame` is at the start of an iteration. Its simple lines run one
+    // after the other, without the checks the frame loop makes between
+    // statements. Stops at the start of an iteration when the fuel would
+    // run out inside the next one or a checkpoint is due, and at the end
+    // of the loop; the frame loop then carries on from there.
+    void runStraight(Frame& frame, long& fuel) {
+
+        const Block& body = *frame.block;
+        long size = (long)body.statements.size();
+
+        while ((fuel < 0 || fuel >= size) && !checkpointRequested &&
+               (checkpointEvery == 0 || sinceCheckpoint + size < checkpointEvery)) {
+
+            for (const Statement& statement : body.statements)
+                runInstruction(body, statement);
+
+            if (fuel > 0)
+                fuel -= size;
+
+            sinceCheckpoint += size;
+
+            if (!repeatLoop(frame)) {
+                frame.pc = body.statements.size();
+                return;
+            }
+        }
+    }
+
+    // ============================================
+    // Charge the counters since the last call to the running body
+    // ============================================
+    // Called just before the innermost body changes. The body is
+    // identified by the line of the loop or if that entered it, which is
+    // the statement its parent frame has just run.
+    NAN_COLD void chargePerf() {
+
+        PerfSample now;
+        perf->read(now);
+
+        int line = 0;
+
+        if (frames.size() > 1) {
+            const Frame& parent = frames[frames.size() - 2];
+            line = parent.block->statements[parent.pc - 1].lineNumber;
+        }
+
+        PerfSample& total = (*perfData)[line];
+
+        for (int i = 0; i < PerfEventCount; i++)
+            total.value[i] += now.value[i] - perfLast.value[i];
+
+        perfLast = now;
+    }
+
+    // ============================================
+    // Save a checkpoint without stopping the script
+    // ============================================
+    // The snapshot is written by a forked child process. The child sees a
+    // copy-on-write image of the interpreter frozen at this moment, so the
+    // script keeps running while the file is written. The file is written
+    // under a temporary name and renamed, so a crash never leaves half a
+    // snapshot behind.
+    void writeCheckpoint() {
+
+        bool requested = checkpointRequested;
+
+        checkpointRequested = false;
+        sinceCheckpoint = 0;
+
+        if (checkpointPath.empty())
+            return;
+
+        // Timers and sleeps are not part of a snapshot: skip it while
+        // they are on the frame stack
+        if (!sleeps.empty() || frames.front().block != program.get())
+            return;
+
+        // The snapshot stores where every written file ends
+        for (auto& file : files)
+            file.second->flush();
+
+        OutputPosition output;
+
+#ifndef _WIN32
+        // A periodic checkpoint is skipped while the last one is still
+        // being written; the checkpoint command waits for it instead
+        if (checkpointWriter > 0) {
+            if (waitpid(checkpointWriter, nullptr, requested ? 0 : WNOHANG) == 0)
+                return;
+            checkpointWriter = -1;
+        }
+
+        // How much of stdout belongs to the state being saved
+        // (only meaningful when stdout is a regular file)
+        struct stat info;
+
+        if (out == &std::cout && fstat(STDOUT_FILENO, &info) == 0 && S_ISREG(info.st_mode)) {
+            std::cout.flush();
+            output.offset = lseek(STDOUT_FILENO, 0, SEEK_CUR);
+            output.device = info.st_dev;
+            output.inode = info.st_ino;
+        }
+
+        pid_t child = fork();
+
+        if (child == 0) {
+            _exit(writeSnapshotFile(saveState(output)) ? 0 : 1);
+        }
+
+        if (child > 0) {
+            checkpointWriter = child;
+            return;
+        }
+#else
+        (void)requested;
+#endif
+
+        // No fork available: write it here
+        writeSnapshotFile(saveState(output));
+    }
+
+    bool writeSnapshotFile(const std::string& snapshot) const {
+
+        std::string temp = checkpointPath + ".tmp";
+
+        {
+            std::ofstream file(temp, std::ios::binary);
+
+            if (!file.is_open() || !file.write(snapshot.data(), snapshot.size()))
+                return false;
+        }
+
+        return std::rename(temp.c_str(), checkpointPath.c_str()) == 0;
+    }
+
+    // Wait until the last checkpoint is safely on disk
+    void finishCheckpoint() {
+#ifndef _WIN32
+        if (checkpointWriter > 0) {
+            waitpid(checkpointWriter, nullptr, 0);
+            checkpointWriter = -1;
+        }
+#endif
+    }
+
+    // ============================================
+    // Error reports
+    // ============================================
+    // Kept out of line (NAN_COLD) so the hot paths that call them stay small
+    NAN_COLD void reportNotFound(const std::string& var) {
+        *out << "Error: variable '" << var << "' not found\n";
+    }
+
+    NAN_COLD void reportError(const char* message) {
+        *out << "Error: " << message << "\n";
+    }
+
+    NAN_COLD void reportPattern(const std::string& problem) {
+        *out << "Error: bad pattern: " << problem << "\n";
+    }
+
+    NAN_COLD void reportInvalidOperator() {
+        *out << "Invalid operator in condition\n";
+    }
+
+public:
+
+    // A script run for one input line stopped with an error (see LineRunner)
+    NAN_COLD void reportLineError(Int lineNumber, const char* reason) {
+        *out << "Error: input line " << lineNumber << " stopped the script (" << reason << ")\n";
+    }
+
+private:
+
+    NAN_COLD void reportBadLoop() {
+        *out << "Syntax error: expected (\n";
+    }
+
+    NAN_COLD void reportFileNotOpen(const std::string& handle) {
+        *out << "Error: file '" << handle << "' is not open\n";
+    }
+
+    // ============================================
+    // Files
+    // ============================================
+    // The handle is also an integer variable: 1 while the file is open
+    // and the last read worked, 0 after a read found the end of the file
+    // (or a failed open, or close). So "while f == 1 (" reads to the end.
+    NAN_COLD void openFile(const std::string& handle, const std::string& path,
+                           const std::string& mode) {
+
+        if (mode != "read" && mode != "write" && mode != "append") {
+            reportError("open expects read, write or append");
+            return;
+        }
+
+        auto file = std::make_unique<ScriptFile>();
+
+        bool opened = mode == "read" ? file->openRead(path)
+                                     : file->openWrite(path, mode == "append");
+
+        files.erase(handle);
+        variables[handle] = opened;
+
+        if (!opened) {
+            *out << "Error: could not open file '" << path << "'\n";
+            return;
+        }
+
+        files[handle] = std::move(file);
+    }
+
+    ScriptFile* findFile(const std::string& handle) {
+
+        auto it = files.find(handle);
+
+        if (it == files.end()) {
+            reportFileNotOpen(handle);
+            return nullptr;
+        }
+
+        return it->second.get();
+    }
+
+    ScriptFile* readerOf(const std::string& handle) {
+
+        ScriptFile* file = findFile(handle);
+
+        if (file && !file->isReading()) {
+            reportError("file was opened for writing");
+            return nullptr;
+        }
+
+        return file;
+    }
+
+    ScriptFile* writerOf(const std::string& handle) {
+
+        ScriptFile* file = findFile(handle);
+
+        if (file && file->isReading()) {
+            reportError("file was opened for reading");
+            return nullptr;
+        }
+
+        return file;
+    }
+
+    // Read the next word of the file into an integer variable.
+    // Returns false at the end of the file.
+    bool readInt(ScriptFile& file, const std::string& var) {
+
+        std::string_view word;
+
+        if (!file.readWord(word))
+            return false;
+
+        long long value;
+
+        if (!parseWholeNumber(word, value) || (Int)value != value) {
+            *out << "Error: '" << word << "' is not a number\n";
+            return true;
+        }
+
+        texts.erase(var);   // var is an integer variable now
+        variables[var] = (Int)value;
+
+        return true;
+    }
+
+    // ============================================
+    // Arrays
+    // ============================================
+    NAN_COLD void loadArrays(const std::string& path, const std::vector<std::string>& names) {
+
+        if (names.empty()) {
+            reportError("load expects: load \"file\" cols a b c");
+            return;
+        }
+
+        std::vector<std::vector<Int>> columns;
+        size_t bad = 0;
+
+        if (!loadColumns(path, names, columns, bad)) {
+            *out << "Error: could not open file '" << path << "'\n";
+            return;
+        }
+
+        size_t next = 0;
+
+        for (const std::string& name : names)
+            if (name != "_") {
+                textArrays.erase(name);
+                arrays[name] = ScriptArray<Int>(std::move(columns[next++]));
+            }
+
+        if (bad > 0)
+            *out << "Warning: " << bad << " cells of '" << path
+                 << "' were missing or not whole numbers (loaded as 0)\n";
+    }
+
+    NAN_COLD void loadArray(const std::string& name, const std::string& path, bool verify) {
+
+        ScriptArray<Int> array;
+        std::string error = loadNanbin(path, array, verify);
+
+        if (!error.empty()) {
+            *out << "Error: " << error << "\n";
+            return;
+        }
+
+        textArrays.erase(name);
+        arrays[name] = std::move(array);
+    }
+
+    NAN_COLD void makeArray(const std::string& name, const std::string& path,
+                            const std::string& countToken) {
+
+        Int count = 0;
+
+        if (!(countToken.empty() && !path.empty()) && !valueOf(countToken, count))
+            return;
+
+        if (count < 0) {
+            reportError("an array can not have a negative size");
+            return;
+        }
+
+        ScriptArray<Int> array;
+
+        if (path.empty()) {
+            array = ScriptArray<Int>(std::vector<Int>(count));
+        }
+        else {
+            std::string error = array.map(path, count);
+
+            if (!error.empty()) {
+                *out << "Error: " << error << "\n";
+                return;
+            }
+        }
+
+        textArrays.erase(name);
+        arrays[name] = std::move(array);
+    }
+
+    typename std::map<std::string, ScriptArray<Int>>::iterator findArray(const std::string& name) {
+
+        auto it = arrays.find(name);
+
+        if (it == arrays.end())
+            *out << "Error: array '" << name << "' not found\n";
+
+        return it;
+    }
+
+    NAN_COLD void reportIndex(Int index, size_t size) {
+        *out << "Error: index " << index << " is outside the array (size " << size << ")\n";
+    }
+
+    bool checkIndex(Int index, size_t size) {
+
+        if (index >= 0 && (size_t)index < size)
+            return true;
+
+        reportIndex(index, size);
+        return false;
+    }
+
+    // Only looked up when there are any, so integer arrays pay nothing
+    const TextArray* findTextArray(const std::string& name) const {
+
+        if (textArrays.empty())
+            return nullptr;
+
+        auto it = textArrays.find(name);
+
+        return it != textArrays.end() ? &it->second : nullptr;
+    }
+
+    // readfiles paths contents: read every file named in `paths` (see
+    // readFiles). `paths` is a text array, or a text with one file name
+    // per line.
+    NAN_COLD void readFileList(const std::string& paths, const std::string& name) {
+
+        const TextArray* list = findTextArray(paths);
+        std::vector<std::string_view> lines;
+
+        if (!list) {
+
+            auto text = texts.find(paths);
+
+            if (text == texts.end()) {
+                *out << "Error: array '" << paths << "' of file names not found\n";
+                return;
+            }
+
+            std::string_view rest(text->second);
+
+            while (!rest.empty()) {
+
+                size_t end = std::min(rest.find('\n'), rest.size());
+                std::string_view line = rest.substr(0, end);
+
+                if (!line.empty() && line.back() == '\r')
+                    line.remove_suffix(1);
+
+                if (!line.empty())
+                    lines.push_back(line);
+
+                rest.remove_prefix(std::min(end + 1, rest.size()));
+            }
+        }
+
+        size_t failed = 0;
+        TextArray contents = readFiles(list ? list->pieces : lines, failed);
+
+        if (failed > 0)
+            *out << "Warning: " << failed << " files could not be read\n";
+
+        arrays.erase(name);
+        textArrays[name] = std::move(contents);
+    }
+
+    // ============================================
+    // Texts
+    // ============================================
+    // A text variable. Reports an error if there is none.
+    const std::string* findText(const std::string& name) {
+
+        auto it = texts.find(name);
+
+        if (it != texts.end())
+            return &it->second;
+
+        reportNotFound(name);
+        return nullptr;
+    }
+
+    // set var = source, where source is not an integer variable
+    NAN_COLD void copyText(const std::string& var, const std::string& source) {
+
+        auto it = texts.find(source);
+
+        if (it == texts.end()) {
+            reportNotFound(source);
+            return;
+        }
+
+        std::string text = it->second;
+        setText(var, text);
+    }
+
+    // A text variable, or an integer variable as text
+    bool textValue(const std::string& name, std::string& value) {
+
+        auto number = variables.find(name);
+
+        if (number != variables.end()) {
+            value = std::to_string(number->second);
+            return true;
+        }
+
+        const std::string* text = findText(name);
+
+        if (text)
+            value = *text;
+
+        return text != nullptr;
+    }
+
+    // split s "," parts: the pieces of s between the separators
+    void splitText(const std::string& text, const std::string& separator,
+                   const std::string& name) {
+
+        if (separator.empty()) {
+            reportError("split needs a separator");
+            return;
+        }
+
+        TextArray parts;
+        parts.text = std::make_shared<const std::string>(text);
+
+        std::string_view rest(*parts.text);
+
+        while (true) {
+
+            size_t found = ::findText(rest, separator);
+
+            parts.pieces.push_back(rest.substr(0, found));
+
+            if (found == std::string_view::npos)
+                break;
+
+            rest.remove_prefix(found + separator.size());
+        }
+
+        arrays.erase(name);
+        textArrays[name] = std::move(parts);
+    }
+
+    // A variable, or else a whole number. Reports an error otherwise.
+    bool valueOf(const std::string& token, Int& value) {
+
+        auto it = variables.find(token);
+
+        if (it != variables.end()) {
+            value = it->second;
+            return true;
+        }
+
+        long long number;
+
+        if (parseWholeNumber(token, number) && (Int)number == number) {
+            value = (Int)number;
+            return true;
+        }
+
+        reportNotFound(token);
+        return false;
+    }
+
+    // What "print name" shows when name is not an integer variable:
+    // the text variable, or else the name itself
+    const std::string& textOf(const std::string& name) const {
+
+        auto it = texts.find(name);
+
+        return it != texts.end() ? it->second : name;
+    }
+
+    // What "print name" shows, as text
+    std::string valueText(const std::string& name) const {
+
+        auto it = variables.find(name);
+
+        return it != variables.end() ? std::to_string(it->second) : textOf(name);
+    }
+
+    // ============================================
+    // Execute the compiled instruction of a line
+    // ============================================
+    // Does the same as runLine(statement.text), without parsing the text
+    void runInstruction(const Block& block, const Statement& statement) {
+
+        const unsigned char* pc =
+            (const unsigned char*)block.code.data() + statement.codeOffset;
+        const std::vector<std::string>& constants = block.constants;
+
+        OpCode op = (OpCode)*pc++;
+
+        switch (op) {
+
+        case OpNop:
+            break;
+
+        case OpPrintText:
+            *out << constants[decodeNumber(pc)] << std::endl;
+            break;
+
+        case OpPrintVar: {
+            const std::string& name = constants[decodeNumber(pc)];
+            auto it = variables.find(name);
+
+            if (it != variables.end())
+                *out << it->second << std::endl;
+            else
+                *out << textOf(name) << std::endl;
+            break;
+        }
+
+        case OpSetConst: {
+            const std::string& var = constants[decodeNumber(pc)];
+            variables[var] = (Int)decodeSigned(pc);
+            break;
+        }
+
+        case OpSetVar: {
+            const std::string& var = constants[decodeNumber(pc)];
+            const std::string& source = constants[decodeNumber(pc)];
+            auto it = variables.find(source);
+
+            if (it != variables.end())
+                variables[var] = it->second;
+            else
+                copyText(var, source);
+            break;
+        }
+
+        case OpSetText: {
+            const std::string& var = constants[decodeNumber(pc)];
+            setText(var, constants[decodeNumber(pc)]);
+            break;
+        }
+
+        case OpAdd:
+        case OpSub:
+        case OpMult:
+        case OpDiv: {
+            const std::string& var = constants[decodeNumber(pc)];
+            Int value = (Int)decodeSigned(pc);
+            auto it = variables.find(var);
+
+            if (it == variables.end()) {
+                reportNotFound(var);
+                break;
+            }
+
+            if (op == OpDiv) {
+                if constexpr (Policy::checkDivision) {
+                    if (value == 0) {
+                        reportError("division by zero");
+                        break;
+                    }
+                }
+            }
+
+            calculate(op == OpAdd ? '+' : op == OpSub ? '-' : op == OpMult ? '*' : '/',
+                      it->second, value);
+            break;
+        }
+
+        case OpOpen: {
+            const std::string& handle = constants[decodeNumber(pc)];
+            const std::string& path = constants[decodeNumber(pc)];
+            openFile(handle, path, constants[decodeNumber(pc)]);
+            break;
+        }
+
+        case OpReadLine: {
+            const std::string& handle = constants[decodeNumber(pc)];
+            const std::string& var = constants[decodeNumber(pc)];
+            ScriptFile* file = readerOf(handle);
+
+            if (file) {
+                variables.erase(var);   // var is a text variable now
+                variables[handle] = file->readLine(texts[var]);
+            }
+            break;
+        }
+
+        case OpReadInt: {
+            const std::string& handle = constants[decodeNumber(pc)];
+            const std::string& var = constants[decodeNumber(pc)];
+            ScriptFile* file = readerOf(handle);
+
+            if (file)
+                variables[handle] = readInt(*file, var);
+            break;
+        }
+
+        case OpWriteText:
+        case OpWriteVar: {
+            ScriptFile* file = writerOf(constants[decodeNumber(pc)]);
+            const std::string& text = constants[decodeNumber(pc)];
+
+            if (file)
+                file->write(op == OpWriteText ? text : valueText(text));
+            break;
+        }
+
+        case OpClose: {
+            const std::string& handle = constants[decodeNumber(pc)];
+
+            if (!files.erase(handle))
+                reportFileNotOpen(handle);
+            else
+                variables[handle] = 0;
+            break;
+        }
+
+        case OpLoad: {
+            const std::string& path = constants[decodeNumber(pc)];
+            std::vector<std::string> names(decodeNumber(pc));
+
+            for (std::string& name : names)
+                name = constants[decodeNumber(pc)];
+
+            loadArrays(path, names);
+            break;
+        }
+
+        case OpArray: {
+            const std::string& name = constants[decodeNumber(pc)];
+            const std::string& path = constants[decodeNumber(pc)];
+            makeArray(name, path, constants[decodeNumber(pc)]);
+            break;
+        }
+
+        case OpSave: {
+            auto array = findArray(constants[decodeNumber(pc)]);
+            const std::string& path = constants[decodeNumber(pc)];
+            bool compress = decodeNumber(pc);
+
+            if (array != arrays.end() && !saveNanbin(path, array->second, compress))
+                *out << "Error: could not save file '" << path << "'\n";
+            break;
+        }
+
+        case OpLoadArray: {
+            const std::string& name = constants[decodeNumber(pc)];
+            const std::string& path = constants[decodeNumber(pc)];
+            loadArray(name, path, decodeNumber(pc));
+            break;
+        }
+
+        case OpFind:
+        case OpContains:
+        case OpSplit: {
+            const std::string& textName = constants[decodeNumber(pc)];
+            const std::string& needleToken = constants[decodeNumber(pc)];
+            bool quoted = decodeNumber(pc);
+            const std::string& target = constants[decodeNumber(pc)];
+
+            const std::string* text = findText(textName);
+            std::string needle = needleToken;
+
+            if (!text || (!quoted && !textValue(needleToken, needle)))
+                break;
+
+            if (op == OpSplit) {
+                splitText(*text, needle, target);
+                break;
+            }
+
+            size_t found = ::findText(*text, needle);
+
+            if (op == OpFind)
+                setVariable(target, found == std::string::npos ? -1 : (Int)found);
+            else
+                setVariable(target, found != std::string::npos);
+            break;
+        }
+
+        case OpMatch: {
+            const std::string* text = findText(constants[decodeNumber(pc)]);
+            Regex& pattern = *block.patterns[decodeNumber(pc)];
+            const std::string& target = constants[decodeNumber(pc)];
+
+            if (!pattern.problem().empty())
+                reportPattern(pattern.problem());
+            else if (text)
+                setVariable(target, pattern.search(*text));
+            break;
+        }
+
+        case OpReadFiles: {
+            const std::string& paths = constants[decodeNumber(pc)];
+            readFileList(paths, constants[decodeNumber(pc)]);
+            break;
+        }
+
+        case OpSize: {
+            const std::string& name = constants[decodeNumber(pc)];
+            const std::string& var = constants[decodeNumber(pc)];
+
+            if (const TextArray* parts = findTextArray(name)) {
+                setVariable(var, (Int)parts->pieces.size());
+                break;
+            }
+
+            auto array = findArray(name);
+
+            if (array != arrays.end())
+                setVariable(var, (Int)array->second.size());
+            break;
+        }
+
+        case OpGet:
+        case OpPut: {
+            const std::string& name = constants[decodeNumber(pc)];
+            const std::string& indexToken = constants[decodeNumber(pc)];
+            const std::string& valueToken = constants[decodeNumber(pc)];
+            Int index;
+
+            if (const TextArray* parts = findTextArray(name)) {
+                if (op == OpPut)
+                    reportError("the pieces made by split can not be changed");
+                else if (valueOf(indexToken, index) &&
+                         checkIndex(index, parts->pieces.size()))
+                    setText(valueToken, parts->pieces[index]);
+                break;
+            }
+
+            auto array = findArray(name);
+
+            if (array == arrays.end() || !valueOf(indexToken, index))
+                break;
+
+            if (!checkIndex(index, array->second.size()))
+                break;
+
+            Int& element = array->second.at(index);
+
+            if (op == OpGet)
+                setVariable(valueToken, element);
+            else
+                valueOf(valueToken, element);
+            break;
+        }
+
+        case OpCheckpoint:
+            checkpointRequested = true;
+            break;
+
+        case OpSleep: {
+            Int milliseconds;
+
+            if (valueOf(constants[decodeNumber(pc)], milliseconds))
+                startSleep(milliseconds);
+            break;
+        }
+
+        case OpStop:
+            stopTimer();
+            break;
+
+        case OpUnknown:
+            *out << "Unknown command: " << constants[decodeNumber(pc)] << std::endl;
+            break;
+
+        case OpLine:
+            runLine(statement.text);
+            break;
+        }
+    }
+
+    // ============================================
+    // Execute one single line of code
+    // ============================================
+    // Only used for lines the bytecode does not cover (see OpLine),
+    // so it is kept away from the hot code too
+    NAN_COLD void runLine(const std::string& line) {
+
+
+        // Ignore empty lines
+        if (line.empty())
+            return;
+
+        // If line starts with "comment", ignore it
+        if (line.rfind("comment", 0) == 0)
+            return;
+
+
+        // Create a stream for parsing the line
+        std::istringstream ss(line);
+
+        std::string command;
+
+
+        // Read the first word (the command)
+        ss >> command;
+
+        // =========================
+        // PRINT COMMAND
+        // =========================
+        if (command == "print") {
+
+            // Get everything after the word "print"
+            std::string restOfLine;
+            std::getline(ss, restOfLine);
+
+            // Remove leading space (because getline keeps it)
+            if (!restOfLine.empty() && restOfLine[0] == ' ')
+                restOfLine.erase(0, 1);
+
+            // ---------------------------------------
+            // Case 1: If it's a quoted string
+            // Example:
+            // print "Hello World"
+            // ---------------------------------------
+            if (restOfLine.size() >= 2 &&
+                restOfLine.front() == '"' &&
+                restOfLine.back() == '"') {
+
+                // Remove the quotes
+                std::string text =
+                    restOfLine.substr(1, restOfLine.size() - 2);
+
+                *out << text << std::endl;
+            }
+
+            // ---------------------------------------
+            // Case 2: If it's a variable name
+            // Example:
+            // print x
+            // ---------------------------------------
+            else {
+
+                if (variables.count(restOfLine)) {
+                    *out << variables[restOfLine] << std::endl;
+                }
+                else {
+                    // If not a variable, just print as-is
+                    *out << restOfLine << std::endl;
+                }
+            }
+        }
+
+        // =========================
+        // SET COMMAND
+        // =========================
+        // Example:
+        // set x = 5
+        else if (command == "set") {
+
+            std::string var;
+            std::string valueToken;
+
+            ss >> var >> valueToken;
+
+            // Case 1: set x = 5
+            if (valueToken == "=") {
+                ss >> valueToken;
+            }
+
+            // Now valueToken can be:
+            // - a number
+            // - a variable name
+
+            // Check if it's a number
+            if (std::isdigit(valueToken[0]) || 
+                (valueToken[0] == '-' && valueToken.size() > 1)) {
+
+                variables[var] = toInt(valueToken);
+            }
+            else {
+                // Otherwise treat it as variable
+                if (variables.count(valueToken)) {
+                    variables[var] = variables[valueToken];
+                }
+                else {
+                    *out << "Error: variable '" 
+                            << valueToken 
+                            << "' not found\n";
+                }
+            }
+        }
+
+
+        // =========================
+        // ADD COMMAND
+        // =========================
+        // Example:
+        // add x 3
+        else if (command == "add") {
+
+            std::string var;
+            Int value;
+
+            ss >> var >> value;
+
+            // Only add if variable exists
+            if (variables.count(var)) {
+                calculate('+', variables[var], value);
+            }
+            else {
+                *out << "Error: variable '" << var << "' not found\n";
+            }
+        }
+
+        // =========================
+        // SUB COMMAND
+        // Example:
+        // sub x 3
+        // =========================
+        else if (command == "sub") {
+
+            std::string var;
+            Int value;
+
+            ss >> var >> value;
+
+            if (variables.count(var)) {
+                calculate('-', variables[var], value);
+            }
+            else {
+                *out << "Error: variable '" << var << "' not found\n";
+            }
+        }
+
+        // =========================
+        // MULT COMMAND
+        // Example:
+        // mult x 3
+        // =========================
+        else if (command == "mult") {
+
+            std::string var;
+            Int value;
+
+            ss >> var >> value;
+
+            if (variables.count(var)) {
+                calculate('*', variables[var], value);
+            }
+            else {
+                *out << "Error: variable '" << var << "' not found\n";
+            }
+        }
+
+        // =========================
+        // DIV COMMAND
+        // Example:
+        // div x 2
+        // =========================
+        else if (command == "div") {
+
+            std::string var;
+            Int value;
+
+            ss >> var >> value;
+
+            if (!variables.count(var)) {
+                *out << "Error: variable '" << var << "' not found\n";
+                return;
+            }
+
+            if constexpr (Policy::checkDivision) {
+                if (value == 0) {
+                    *out << "Error: division by zero\n";
+                    return;
+                }
+            }
+
+            calculate('/', variables[var], value);
+        }
+
+        // =========================
+        // CHECKPOINT COMMAND
+        // =========================
+        // Example:
+        // checkpoint
+        // Saves the state once this line is done (see writeCheckpoint)
+        else if (command == "checkpoint") {
+            checkpointRequested = true;
+        }
+
+        // =========================
+        // UNKNOWN COMMAND
+        // =========================
+        else {
+            *out << "Unknown command: " << command << std::endl;
+        }
+    }
+    
+    // ============================================
+    // Arithmetic for add / sub / mult / div
+    // ============================================
+    // With overflow checks on, a result that does not fit prints an error
+    // and leaves the variable unchanged.
+    void calculate(char op, Int& target, Int value) {
+
+        if constexpr (Policy::checkOverflow) {
+
+            // Check the range before doing the math, so the overflow
+            // itself never happens
+            const Int max = std::numeric_limits<Int>::max();
+            const Int min = std::numeric_limits<Int>::min();
+            bool overflow;
+
+            switch (op) {
+            case '+':
+                overflow = value > 0 ? target > max - value : target < min - value;
+                break;
+            case '-':
+                overflow = value < 0 ? target > max + value : target < min + value;
+                break;
+            case '*':
+                if (target == 0 || value == 0)
+                    overflow = false;
+                else if (target > 0)
+                    overflow = value > 0 ? target > max / value : value < min / target;
+                else
+                    overflow = value > 0 ? target < min / value : value < max / target;
+                break;
+            default:
+                // Only MIN / -1 overflows a division
+                overflow = value == -1 && target == min;
+                break;
+            }
+
+            if (overflow) {
+                reportError("overflow");
+                return;
+            }
+
+            switch (op) {
+            case '+': target += value; break;
+            case '-': target -= value; break;
+            case '*': target *= value; break;
+            default:  target /= value; break;
+            }
+        }
+        else {
+            // Wrap around like the hardware does, but without undefined
+            // behavior: the math is done on unsigned numbers
+            using Unsigned = std::make_unsigned_t<Int>;
+
+            switch (op) {
+            case '+': target = (Int)((Unsigned)target + (Unsigned)value); break;
+            case '-': target = (Int)((Unsigned)target - (Unsigned)value); break;
+            case '*': target = (Int)((Unsigned)target * (Unsigned)value); break;
+            default:
+                // MIN / -1 would trap: it wraps back to MIN
+                if (value == -1)
+                    target = (Int)(0 - (Unsigned)target);
+                else
+                    target /= value;
+                break;
+            }
+        }
+    }
+
+    // A variable, or else a number. A text variable counts as 0, like
+    // in awk (for example a header line in --each-line mode).
+    Int operandValue(const std::string& token) {
+
+        auto it = variables.find(token);
+
+        if (it != variables.end())
+            return it->second;
+
+        if (!token.empty() && !std::isdigit((unsigned char)token[0]) &&
+            token[0] != '-' && token[0] != '+' && texts.count(token))
+            return 0;
+
+        // Plain numbers skip std::stoi; anything else still goes through
+        // it for the same result and the same exceptions
+        long long value;
+
+        if (parseWholeNumber(token, value) && (Int)value == value)
+            return (Int)value;
+
+        return toInt(token);
+    }
+
+    bool evaluateCondition(const std::string& condition) {
+
+        // Split "x > 3" without a string stream: conditions of while
+        // loops are evaluated on every iteration
+        size_t pos = 0;
+        std::string left(nextWord(condition, pos));
+        std::string_view op = nextWord(condition, pos);
+        std::string right(nextWord(condition, pos));
+
+        Int leftVal = operandValue(left);
+        Int rightVal = operandValue(right);
+
+        // Comparison
+        if (op == ">")  return leftVal > rightVal;
+        if (op == "<")  return leftVal < rightVal;
+        if (op == ">=") return leftVal >= rightVal;
+        if (op == "<=") return leftVal <= rightVal;
+        if (op == "==") return leftVal == rightVal;
+        if (op == "!=") return leftVal != rightVal;
+
+        reportInvalidOperator();
+        return false;
+    }
+};
+
+// The interpreter used by this program
+using Interpreter = BasicInterpreter<SelectedPolicy>;
+
+// Variable names and values, e.g. parameters from --param
+using Variables = std::map<std::string, Interpreter::Int>;
+
+// ===============================
+// Time-Sliced Scheduler
+// ===============================
+// Runs many scripts on a small pool of worker threads.
+// Each script gets a slice of fuel; when it reaches a loop back-edge
+// with no fuel left it goes to the back of the queue, so one long
+// script cannot starve the short ones. Scripts are served in
+// round-robin order and may resume on any worker.
+class Scheduler {
+private:
+
+    struct Task {
+        Interpreter interpreter;
+
+        // Output of the current slice, written to std::cout in one piece
+        // so lines from different scripts never get mixed together
+        std::ostringstream output;
+    };
+
+    std::deque<std::unique_ptr<Task>> queue;
+    std::mutex queueMutex;
+    std::condition_variable queueChanged;
+
+    // Tasks that have not finished yet (queued, running or waiting)
+    size_t unfinished = 0;
+
+    // Tasks that wait for a sleep or timer (see Interpreter::isWaiting),
+    // by wake time in milliseconds since `timeBase`. One thread moves
+    // them back to the queue when they are due. Guarded by queueMutex.
+    TimingWheel<std::unique_ptr<Task>> waitingTasks;
+    std::chrono::steady_clock::time_point timeBase = std::chrono::steady_clock::now();
+    EventLoop eventLoop;
+
+    std::mutex outputMutex;
+
+    long slice;
+    int workers;
+
+public:
+
+    Scheduler(int workerCount, long sliceFuel)
+        : slice(sliceFuel), workers(workerCount) {}
+
+    // Queue a script to run
+    void add(const std::string& code, const Variables& params) {
+
+        auto task = std::make_unique<Task>();
+        task->interpreter.setOutput(task->output);
+        task->interpreter.load(Interpreter::compile(code));
+
+        for (const auto& param : params)
+            task->interpreter.setVariable(param.first, param.second);
+
+        std::lock_guard<std::mutex> lock(queueMutex);
+        queue.push_back(std::move(task));
+        unfinished++;
+    }
+
+    // Run every queued script to the end
+    void run() {
+
+        std::vector<std::thread> threads;
+
+        for (int i = 0; i < workers; i++)
+            threads.emplace_back([this] { work(); });
+
+        threads.emplace_back([this] { wakeTasks(); });
+
+        for (std::thread& thread : threads)
+            thread.join();
+    }
+
+private:
+
+    void work() {
+
+        while (true) {
+
+            std::unique_ptr<Task> task;
+
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+
+                queueChanged.wait(lock, [this] {
+                    return !queue.empty() || unfinished == 0;
+                });
+
+                if (queue.empty())
+                    return;
+
+                task = std::move(queue.front());
+                queue.pop_front();
+            }
+
+            bool finished = task->interpreter.run(slice);
+
+            // Flush what this slice printed
+            {
+                std::lock_guard<std::mutex> lock(outputMutex);
+                std::cout << task->output.str() << std::flush;
+            }
+            task->output.str("");
+
+            bool waiting = !finished && task->interpreter.isWaiting();
+            uint64_t wakeTime = waiting ? millisecondsAt(task->interpreter.wakeTime()) + 1 : 0;
+
+            {
+                std::lock_guard<std::mutex> lock(queueMutex);
+
+                if (finished)
+                    unfinished--;
+                else if (waiting)
+                    waitingTasks.insert(wakeTime, std::move(task));
+                else
+                    queue.push_back(std::move(task));
+            }
+
+            // The waking thread may need an earlier deadline, or to quit
+            if (finished || waiting)
+                eventLoop.wake();
+
+            queueChanged.notify_all();
+        }
+    }
+
+    uint64_t millisecondsAt(std::chrono::steady_clock::time_point time) const {
+
+        if (time <= timeBase)
+            return 0;
+
+        return std::chrono::duration_cast<std::chrono::milliseconds>(time - timeBase).count();
+    }
+
+    // Move waiting tasks back to the queue when they are due
+    void wakeTasks() {
+
+        while (true) {
+
+            bool any;
+            uint64_t next;
+
+            {
+                std::lock_guard<std::mutex> lock(queueMutex);
+
+                if (unfinished == 0)
+                    return;
+
+                size_t queued = queue.size();
+
+                waitingTasks.advance(millisecondsAt(std::chrono::steady_clock::now()),
+                                     [this](std::unique_ptr<Task> task) {
+                    queue.push_back(std::move(task));
+                });
+
+                if (queue.size() != queued)
+                    queueChanged.notify_all();
+
+                any = !waitingTasks.empty();
+                next = any ? waitingTasks.nextDeadline() : 0;
+            }
+
+            if (any)
+                eventLoop.waitUntil(timeBase + std::chrono::milliseconds(next));
+            else
+                eventLoop.wait();
+        }
+    }
+};
+
+// ============================================
+// Parse "name=value" into a parameter map
+// ============================================
+static bool parseParam(const std::string& text, Variables& params) {
+
+    size_t equalPos = text.find('=');
+
+    if (equalPos == std::string::npos || equalPos == 0)
+        return false;
+
+    try {
+        params[text.substr(0, equalPos)] = Interpreter::toInt(text.substr(equalPos + 1));
+    }
+    catch (const std::exception&) {
+        return false;
+    }
+
+    return true;
+}
+
+// ============================================
+// Parse the number after an option like --workers
+// ============================================
+// False if it is not a whole number from `low` to `high`
+static bool parseOptionNumber(const std::string& text, long low, long high, long& value) {
+
+    try {
+        size_t used = 0;
+        value = std::stol(text, &used);
+
+        return used == text.size() && value >= low && value <= high;
+    }
+    catch (const std::exception&) {
+        return false;
+    }
+}
+
+#ifndef _WIN32
+
+// ===============================
+// Daemon Mode (--serve / --client)
+// ===============================
+// A long-running server keeps parsed programs in memory and runs
+// requests sent over a Unix domain socket, so tiny scripts do not pay
+// for process startup and parsing every time.
+//
+// A request is plain text, sent by the client before it closes its
+// writing side of the socket:
+//
+//     param x 5            (any number of these)
+//     path /abs/script.txt
+//
+// or, for inline source:
+//
+//     param x 5
+//     source
+//     print "Hello"
+//     ...
+//
+// The server answers with everything the script printed.
+//
+// A client must finish sending within requestReadTimeout, and a script
+// may run for at most the request timeout (--request-timeout).
+
+// Seconds a client may take to send its request
+static const int requestReadTimeout = 10;
+
+// Statements a request runs between two looks at the clock
+static const long requestSlice = 100000;
+
+// Parsed programs, shared by all worker threads
+class ProgramCache {
+private:
+
+    struct Entry {
+        std::shared_ptr<const Block> program;
+        long long modified = 0;    // File time (paths only)
+
+        // Reuses unchanged statements when the file is edited
+        std::shared_ptr<IncrementalParser> parser = std::make_shared<IncrementalParser>();
+    };
+
+    std::map<std::string, Entry> paths;
+    std::map<std::string, std::shared_ptr<const Block>> sources;
+    std::mutex mutex;
+
+    // Inline sources are forgotten when there are too many of them
+    static const size_t maxSources = 1024;
+
+public:
+
+    // Program for a file, parsed again only when the file changes.
+    // Returns nullptr if the file can not be read.
+    //
+    // An edited file replaces the old program in one step: requests that
+    // are already running keep the version they started with, and the
+    // next request gets the new one.
+    std::shared_ptr<const Block> fromPath(const std::string& path) {
+
+        struct stat info;
+
+        if (stat(path.c_str(), &info) != 0)
+            return nullptr;
+
+        long long modified = (long long)info.st_mtim.tv_sec * 1000000000LL
+                             + info.st_mtim.tv_nsec;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            auto it = paths.find(path);
+            if (it != paths.end() && it->second.modified == modified)
+                return it->second.program;
+        }
+
+        std::string code;
+        if (!readFile(path, code))
+            return nullptr;
+
+        // The parser of an entry is not thread-safe, so it runs under the
+        // lock (it only parses the statements that changed)
+        std::lock_guard<std::mutex> lock(mutex);
+
+        Entry& entry = paths[path];
+
+        if (entry.modified != modified) {
+            entry.program = entry.parser->parse(code);
+            entry.modified = modified;
+        }
+
+        return entry.program;
+    }
+
+    // Program for inline source text
+    std::shared_ptr<const Block> fromSource(const std::string& code) {
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            auto it = sources.find(code);
+            if (it != sources.end())
+                return it->second;
+        }
+
+        auto program = Interpreter::compile(code);
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (sources.size() >= maxSources)
+            sources.clear();
+
+        sources[code] = program;
+
+        return program;
+    }
+};
+
+// ============================================
+// Socket helpers
+// ============================================
+// Read until the other side closes its writing side. Returns false if
+// reading failed (for example on a receive timeout) before that.
+static bool readAll(int fd, std::string& data) {
+
+    char chunk[4096];
+    ssize_t count;
+
+    while ((count = read(fd, chunk, sizeof(chunk))) != 0) {
+
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+
+        data.append(chunk, count);
+    }
+
+    return true;
+}
+
+static void writeAll(int fd, const std::string& data) {
+
+    size_t sent = 0;
+
+    while (sent < data.size()) {
+
+        ssize_t count = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+
+        if (count <= 0)
+            return;
+
+        sent += count;
+    }
+}
+
+static bool makeAddress(const std::string& socketPath, sockaddr_un& address) {
+
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        std::cout << "Error: socket path is too long\n";
+        return false;
+    }
+
+    address = sockaddr_un{};
+    address.sun_family = AF_UNIX;
+    socketPath.copy(address.sun_path, socketPath.size());
+
+    return true;
+}
+
+// ============================================
+// Run one request, printing into `output`
+// ============================================
+static void runRequest(const std::string& request, ProgramCache& cache, int timeout,
+                       std::ostringstream& output) {
+
+    std::istringstream stream(request);
+    std::string line;
+    Variables params;
+    std::shared_ptr<const Block> program;
+
+    // Where the next line starts in the request
+    size_t offset = 0;
+
+    while (std::getline(stream, line)) {
+
+        offset += line.size() + 1;
+
+        std::istringstream ss(line);
+        std::string keyword;
+        ss >> keyword;
+
+        if (keyword == "param") {
+
+            std::string name;
+            Interpreter::Int value;
+
+            if (ss >> name >> value)
+                params[name] = value;
+        }
+        else if (keyword == "path") {
+
+            std::string path;
+            std::getline(ss, path);
+            path.erase(0, path.find_first_not_of(" "));
+
+            program = cache.fromPath(path);
+
+            if (!program) {
+                output << "Error: Could not open file.\n";
+                return;
+            }
+
+            break;
+        }
+        else if (keyword == "source") {
+
+            // Everything after this line is the script
+            std::string code = request.substr(std::min(offset, request.size()));
+
+            program = cache.fromSource(code);
+            break;
+        }
+    }
+
+    if (!program) {
+        output << "Error: empty request\n";
+        return;
+    }
+
+    Interpreter interpreter;
+    interpreter.setOutput(output);
+    interpreter.load(program);
+
+    for (const auto& param : params)
+        interpreter.setVariable(param.first, param.second);
+
+    // Run in slices and stop at the deadline
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(timeout);
+
+    while (!interpreter.run(requestSlice)) {
+
+        if (std::chrono::steady_clock::now() >= deadline) {
+            output << "Error: request stopped after " << timeout << " seconds\n";
+            return;
+        }
+
+        if (interpreter.isWaiting())
+            std::this_thread::sleep_until(std::min(interpreter.wakeTime(), deadline));
+    }
+}
+
+// ============================================
+// Run one request and return what it printed
+// ============================================
+// A script that throws (a bad number, for example) or runs longer than
+// `timeout` seconds only ends its own request; the error is sent back
+// with whatever it printed before.
+static std::string handleRequest(const std::string& request, ProgramCache& cache,
+                                 int timeout) {
+
+    std::ostringstream output;
+
+    try {
+        runRequest(request, cache, timeout, output);
+    }
+    catch (const std::invalid_argument&) {
+        output << "Error: expected a number\n";
+    }
+    catch (const std::out_of_range&) {
+        output << "Error: number out of range\n";
+    }
+    catch (const std::exception& error) {
+        output << "Error: " << error.what() << "\n";
+    }
+
+    return output.str();
+}
+
+// ============================================
+// --serve: answer requests until killed
+// ============================================
+static int serve(const std::string& socketPath, int workers, int timeout) {
+
+    sockaddr_un address;
+    if (!makeAddress(socketPath, address))
+        return 1;
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    // Remove a socket file left behind by an earlier server
+    unlink(socketPath.c_str());
+
+    if (listener < 0 ||
+        bind(listener, (sockaddr*)&address, sizeof(address)) != 0 ||
+        listen(listener, 128) != 0) {
+        std::cout << "Error: could not listen on " << socketPath << "\n";
+        return 1;
+    }
+
+    ProgramCache cache;
+
+    // Every worker takes the next waiting connection itself
+    auto work = [&] {
+        while (true) {
+
+            int client = accept(listener, nullptr, nullptr);
+
+            if (client < 0)
+                continue;
+
+            // A client that never finishes sending must not hold a worker
+            timeval wait{ requestReadTimeout, 0 };
+            setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &wait, sizeof(wait));
+
+            std::string request;
+
+            if (readAll(client, request))
+                writeAll(client, handleRequest(request, cache, timeout));
+            else
+                writeAll(client, "Error: request not received in time\n");
+
+            close(client);
+        }
+    };
+
+    std::vector<std::thread> threads;
+
+    for (int i = 0; i < workers; i++)
+        threads.emplace_back(work);
+
+    for (std::thread& thread : threads)
+        thread.join();
+
+    return 0;
+}
+
+// ============================================
+// --client: send one request and print the answer
+// ============================================
+static int runClient(const std::string& socketPath, const std::string& request) {
+
+    sockaddr_un address;
+    if (!makeAddress(socketPath, address))
+        return 1;
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (server < 0 || connect(server, (sockaddr*)&address, sizeof(address)) != 0) {
+        std::cout << "Error: could not connect to " << socketPath << "\n";
+        return 1;
+    }
+
+    writeAll(server, request);
+    shutdown(server, SHUT_WR);
+
+    std::string answer;
+    readAll(server, answer);
+
+    std::cout << answer << std::flush;
+    close(server);
+
+    return 0;
+}
+
+#endif
+
+// ===============================
+// Result Cache (--cache-dir)
+// ===============================
+// A deterministic script always prints the same thing and ends with the
+// same variables for the same program and parameters. Its result can be
+// stored on disk and replayed next time without running anything.
+
+// Commands whose effect depends only on the program and its variables.
+// A script using any other command (file access, time, randomness,
+// or anything added later) is never cached. The same goes for blocks:
+// only the kinds listed here are allowed, so timers (every / after,
+// whose output depends on how fast the script runs) are never cached.
+static bool isDeterministic(const Block& block) {
+
+    static const char* pureCommands[] = {
+        "print", "set", "add", "sub", "mult", "div", "comment"
+    };
+
+    for (const Statement& statement : block.statements) {
+
+        switch (statement.kind) {
+        case Statement::Line:
+            break;
+
+        case Statement::Loop:
+        case Statement::Ploop:
+        case Statement::If:
+        case Statement::While:
+            if (statement.body && !isDeterministic(statement.body->get()))
+                return false;
+            continue;
+
+        case Statement::BadLoop:
+            continue;
+
+        default:
+            return false;
+        }
+
+        std::istringstream ss(statement.text);
+        std::string command;
+        ss >> command;
+
+        bool pure = false;
+        for (const char* name : pureCommands)
+            pure = pure || command == name;
+
+        if (!pure)
+            return false;
+    }
+
+    return true;
+}
+
+// Write the parsed program in a fixed form, so two scripts that parse
+// to the same tree give the same key (blank lines do not matter)
+static void appendFingerprint(const Block& block, std::string& key) {
+
+    key += "{\n";
+
+    for (const Statement& statement : block.statements) {
+
+        key += std::to_string(statement.kind) + " " + statement.text + "\n";
+
+        if (statement.body)
+            appendFingerprint(statement.body->get(), key);
+    }
+
+    key += "}\n";
+}
+
+// 64-bit FNV-1a hash, used to name cache files
+static uint64_t hashText(const std::string& text) {
+
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (unsigned char c : text) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+class ResultCache {
+private:
+
+    std::filesystem::path directory;
+
+    static constexpr const char* header = "nanLanguage result cache 1";
+
+    std::filesystem::path fileFor(const std::string& key) const {
+
+        std::ostringstream name;
+        name << std::hex << hashText(key) << ".nancache";
+
+        return directory / name.str();
+    }
+
+public:
+
+    explicit ResultCache(const std::string& dir) : directory(dir) {}
+
+    // The full cache key: the parsed program plus the starting variables
+    static std::string keyFor(const Block& program,
+                              const Variables& params) {
+
+        std::string key;
+        appendFingerprint(program, key);
+
+        for (const auto& param : params)
+            key += param.first + "=" + std::to_string(param.second) + "\n";
+
+        return key;
+    }
+
+    // Look up a stored result. The whole key is kept in the file and
+    // compared, so a hash collision can never return a wrong result.
+    bool lookup(const std::string& key, std::string& output,
+                Variables& variables) const {
+
+        std::ifstream file(fileFor(key), std::ios::binary);
+
+        if (!file.is_open())
+            return false;
+
+        std::string line;
+        size_t size = 0;
+
+        if (!std::getline(file, line) || line != header)
+            return false;
+
+        // Stored key
+        if (!(file >> size) || file.get() != '\n')
+            return false;
+
+        std::string storedKey(size, '\0');
+        if (!file.read(&storedKey[0], size) || storedKey != key)
+            return false;
+
+        // Printed output
+        if (!(file >> size) || file.get() != '\n')
+            return false;
+
+        output.assign(size, '\0');
+        if (!file.read(&output[0], size))
+            return false;
+
+        // Final variables
+        size_t count = 0;
+        if (!(file >> count))
+            return false;
+
+        variables.clear();
+
+        for (size_t i = 0; i < count; i++) {
+
+            std::string name;
+            Interpreter::Int value;
+
+            if (!(file >> name >> value))
+                return false;
+
+            variables[name] = value;
+        }
+
+        return true;
+    }
+
+    // Save a result. Written to a temporary file first and renamed,
+    // so a reader never sees half an entry.
+    void store(const std::string& key, const std::string& output,
+               const Variables& variables) const {
+
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+
+        std::filesystem::path target = fileFor(key);
+        std::filesystem::path temp = target;
+        temp += ".tmp" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+
+        {
+            std::ofstream file(temp, std::ios::binary);
+
+            if (!file.is_open())
+                return;
+
+            file << header << "\n"
+                 << key.size() << "\n" << key
+                 << output.size() << "\n" << output
+                 << variables.size() << "\n";
+
+            for (const auto& variable : variables)
+                file << variable.first << " " << variable.second << "\n";
+        }
+
+        std::filesystem::rename(temp, target, error);
+    }
+};
+
+// ============================================
+// Run a program, replaying a cached result when possible
+// ============================================
+// The key covers every variable set before the script starts
+// (parameters and warm-start snapshots), not just the program.
+static void runCached(Interpreter& interpreter, std::shared_ptr<const Block> program,
+                      const ResultCache& cache) {
+
+    if (!isDeterministic(*program)) {
+        interpreter.load(program);
+        interpreter.run();
+        return;
+    }
+
+    std::string key = ResultCache::keyFor(*program, interpreter.getVariables());
+    std::string output;
+    Variables variables;
+
+    // Hit: print the stored output and restore the final variables
+    if (cache.lookup(key, output, variables)) {
+
+        std::cout << output << std::flush;
+
+        for (const auto& variable : variables)
+            interpreter.setVariable(variable.first, variable.second);
+
+        return;
+    }
+
+    // Miss: run the script, then remember what it did
+    std::ostringstream captured;
+
+    interpreter.setOutput(captured);
+    interpreter.load(program);
+    interpreter.run();
+    interpreter.setOutput(std::cout);
+
+    std::cout << captured.str() << std::flush;
+
+    cache.store(key, captured.str(), interpreter.getVariables());
+}
+
+// ===============================
+// Profiles (--record-profile / --use-profile)
+// ===============================
+// A profile counts how often every loop and if of a script ran, by line
+// number. Scripts that run on similar data every night behave the same
+// way every night, so last night's profile tells which bodies will run.
+// With --use-profile those bodies are parsed before the script starts,
+// and counted loops that ran many times per entry with a body of
+// simple lines get the straight-line fast path (see runStraight).
+
+static constexpr const char* profileMagic = "NANPROF1";
+
+// Counters by line number
+using LineProfile = std::map<int, ProfileCounters>;
+
+static bool saveProfile(const std::string& path, const std::string& source,
+                        const ProfileData& data) {
+
+    BinaryWriter writer;
+
+    writer.data = profileMagic;
+    writer.number(hashText(source));
+    writer.number(data.size());
+
+    for (const auto& entry : data) {
+        writer.number(entry.first->lineNumber);
+        writer.number(entry.second.entries);
+        writer.number(entry.second.taken);
+    }
+
+    std::ofstream file(path, std::ios::binary);
+
+    return (bool)file.write(writer.data.data(), writer.data.size());
+}
+
+// Fails if the file is damaged or was made for another version of the script
+static bool loadProfile(const std::string& path, const std::string& source,
+                        LineProfile& profile) {
+
+    std::string data;
+    size_t magicSize = std::string(profileMagic).size();
+
+    if (!readFile(path, data) || data.compare(0, magicSize, profileMagic) != 0)
+        return false;
+
+    BinaryReader reader(data.data() + magicSize, data.size() - magicSize);
+
+    if (reader.number() != hashText(source))
+        return false;
+
+    uint64_t count = reader.number();
+
+    for (uint64_t i = 0; i < count && reader.ok; i++) {
+        ProfileCounters& counters = profile[(int)reader.number()];
+        counters.entries += reader.number();
+        counters.taken += reader.number();
+    }
+
+    return reader.ok;
+}
+
+// Iterations per entry from which a loop counts as hot
+static const uint64_t straightLoopIterations = 64;
+
+// A body the straight-line path can run: only simple lines, and none of
+// the cold instructions (they may sleep, checkpoint or fall back to text)
+static bool isStraightBody(const Block& body) {
+
+    if (body.statements.empty())
+        return false;
+
+    for (const Statement& statement : body.statements)
+        if (statement.kind != Statement::Line ||
+            isColdInstruction((OpCode)(unsigned char)body.code[statement.codeOffset]))
+            return false;
+
+    return true;
+}
+
+// Parse now every body that ran in the profiled run, and mark the hot
+// straight loops
+static void applyProfile(const Block& block, const LineProfile& profile) {
+
+    for (const Statement& statement : block.statements) {
+
+        if (!statement.body)
+            continue;
+
+        auto it = profile.find(statement.lineNumber);
+
+        if (it == profile.end() || it->second.taken == 0)
+            continue;
+
+        const Block& body = statement.body->get();
+
+        if ((statement.kind == Statement::Loop || statement.kind == Statement::Ploop) &&
+            it->second.taken >= it->second.entries * straightLoopIterations &&
+            isStraightBody(body))
+            statement.straight = true;
+
+        applyProfile(body, profile);
+    }
+}
+
+// ===============================
+// Hardware Counter Report
+// ===============================
+// One row per loop or if body (by the line of the loop or if), plus the
+// statements outside any of them. The last column is a rough guess of
+// what limits the body:
+//   memory   - many cache misses per instruction: the data does not
+//              fit in the caches
+//   dispatch - few misses: the time goes to the interpreter itself
+//              (decoding statements, looking up variables, branching)
+
+static std::string perfCell(const PerfCounters& counters, int event, uint64_t value) {
+    return counters.has(event) ? std::to_string(value) : "-";
+}
+
+static void printPerfReport(const PerfCounters& counters, const PerfData& data) {
+
+    std::ostringstream report;
+
+    report << "\nHardware counters by block (line of the loop or if):\n"
+           << "  block        cycles  instructions   IPC  branch-miss    L1D-miss    LLC-miss  bound by\n";
+
+    for (const auto& entry : data) {
+
+        const uint64_t* v = entry.second.value;
+        char line[64];
+        char ipc[16] = "-";
+
+        if (entry.first == 0)
+            std::snprintf(line, sizeof(line), "top level");
+        else
+            std::snprintf(line, sizeof(line), "line %d", entry.first);
+
+        if (counters.has(PerfCycles) && counters.has(PerfInstructions) && v[PerfCycles] > 0)
+            std::snprintf(ipc, sizeof(ipc), "%.2f", (double)v[PerfInstructions] / v[PerfCycles]);
+
+        // Misses per 1000 instructions
+        std::string bound = "-";
+
+        if (counters.has(PerfInstructions) && v[PerfInstructions] > 0 &&
+            (counters.has(PerfL1Misses) || counters.has(PerfLLCMisses))) {
+
+            double l1 = 1000.0 * v[PerfL1Misses] / v[PerfInstructions];
+            double llc = 1000.0 * v[PerfLLCMisses] / v[PerfInstructions];
+
+            bound = (l1 >= 20 || llc >= 1) ? "memory" : "dispatch";
+        }
+
+        char row[256];
+        std::snprintf(row, sizeof(row), "  %-10s %12s %13s %5s %12s %11s %11s  %s\n", line,
+                      perfCell(counters, PerfCycles, v[PerfCycles]).c_str(),
+                      perfCell(counters, PerfInstructions, v[PerfInstructions]).c_str(), ipc,
+                      perfCell(counters, PerfBranchMisses, v[PerfBranchMisses]).c_str(),
+                      perfCell(counters, PerfL1Misses, v[PerfL1Misses]).c_str(),
+                      perfCell(counters, PerfLLCMisses, v[PerfLLCMisses]).c_str(),
+                      bound.c_str());
+        report << row;
+    }
+
+    // The report goes to stderr so it never mixes with the script output
+    std::cerr << report.str();
+}
+
+// ===============================
+// Each-Line Mode (--each-line)
+// ===============================
+// Runs the script once for every line of stdin, like awk. Before each
+// run these variables are set:
+//   line                  the whole line (text)
+//   nr                    the line number, from 1
+//   nf                    the number of fields
+//   field1, field2, ...   the space-separated fields; whole numbers
+//                         become integer variables, the rest text
+// All other variables keep their values from one line to the next, so a
+// script can count and sum as it goes.
+//
+// stdin is read in 1 MB blocks into one reusable buffer, and lines and
+// fields are views into that buffer; nothing is copied until a value is
+// stored in its variable. Like awk, only what the script mentions is
+// stored: a script that uses field2 and nf never pays for field1,
+// field9 or nr.
+
+static const size_t eachLineBlock = 1 << 20;
+
+class LineRunner {
+private:
+
+    Interpreter& interpreter;
+    std::shared_ptr<const Block> program;
+
+    std::vector<std::string_view> fields;
+    std::vector<std::string> fieldNames;    // "field1", "field2", ...
+    Interpreter::Int lineNumber = 0;
+
+    // What the script mentions
+    bool usesLine = false;
+    bool usesNr = false;
+    bool usesNf = false;
+    size_t fieldsUsed = 0;              // Highest N of a "fieldN" in the script
+    std::vector<size_t> storedFields;   // Each N - 1 the script mentions
+
+    static bool isNamePart(char c) {
+        return std::isalnum((unsigned char)c) || c == '_';
+    }
+
+    // Find the whole word `word` in the script, followed by digits if
+    // `numbered`. Returns the largest number found (1 for a plain word),
+    // or 0 if the word is not there. Every number found is marked in
+    // `numbers` when given.
+    static size_t mentions(const std::string& source, const std::string& word, bool numbered,
+                           std::vector<bool>* numbers = nullptr) {
+
+        size_t found = 0;
+
+        for (size_t pos = source.find(word); pos != std::string::npos;
+             pos = source.find(word, pos + 1)) {
+
+            if (pos > 0 && isNamePart(source[pos - 1]))
+                continue;
+
+            size_t end = pos + word.size();
+            size_t number = 0;
+
+            while (numbered && end < source.size() && std::isdigit((unsigned char)source[end]))
+                number = number * 10 + (source[end++] - '0');
+
+            if ((numbered && end == pos + word.size()) ||
+                (end < source.size() && isNamePart(source[end])))
+                continue;
+
+            found = std::max(found, numbered ? number : 1);
+
+            if (numbers && number > 0) {
+                numbers->resize(std::max(numbers->size(), number + 1));
+                (*numbers)[number] = true;
+            }
+        }
+
+        return found;
+    }
+
+public:
+
+    LineRunner(Interpreter& target, std::shared_ptr<const Block> code,
+               const std::string& source)
+        : interpreter(target), program(std::move(code)) {
+
+        std::vector<bool> numbers;
+
+        usesLine = mentions(source, "line", false) > 0;
+        usesNr = mentions(source, "nr", false) > 0;
+        usesNf = mentions(source, "nf", false) > 0;
+        fieldsUsed = mentions(source, "field", true, &numbers);
+
+        for (size_t i = 1; i <= fieldsUsed; i++) {
+
+            fieldNames.push_back("field" + std::to_string(i));
+
+            if (numbers[i])
+                storedFields.push_back(i - 1);
+        }
+    }
+
+    void run(std::string_view line) {
+
+        if (!line.empty() && line.back() == '\r')
+            line.remove_suffix(1);
+
+        // Split in place. Fields after the last one the script uses are
+        // only counted, and only if the script wants nf.
+        fields.clear();
+
+        size_t pos = 0;
+        size_t fieldCount = 0;
+
+        for (std::string_view field = nextWord(line, pos); !field.empty();
+             field = nextWord(line, pos)) {
+
+            if (fieldCount++ < fieldsUsed)
+                fields.push_back(field);
+            else if (!usesNf)
+                break;
+        }
+
+        static const std::string lineName = "line";
+        static const std::string nrName = "nr";
+        static const std::string nfName = "nf";
+
+        lineNumber++;
+
+        if (usesLine)
+            interpreter.setText(lineName, line);
+
+        if (usesNr)
+            interpreter.setVariable(nrName, lineNumber);
+
+        if (usesNf)
+            interpreter.setVariable(nfName, (Interpreter::Int)fieldCount);
+
+        for (size_t i : storedFields) {
+
+            long long value;
+
+            // Fields this line does not have are 0, like in awk, so short,
+            // blank and header lines do not stop the script
+            if (i >= fields.size())
+                interpreter.setVariable(fieldNames[i], 0);
+            else if (parseWholeNumber(fields[i], value) && (Interpreter::Int)value == value)
+                interpreter.setVariable(fieldNames[i], (Interpreter::Int)value);
+            else
+                interpreter.setText(fieldNames[i], fields[i]);
+        }
+
+        // The program is loaded once; every later line starts it over
+        if (lineNumber == 1)
+            interpreter.load(program);
+        else
+            interpreter.restart();
+
+        // A bad line only stops its own run
+        try {
+            interpreter.run();
+        }
+        catch (const std::invalid_argument&) {
+            interpreter.reportLineError(lineNumber, "expected a number");
+        }
+        catch (const std::out_of_range&) {
+            interpreter.reportLineError(lineNumber, "number out of range");
+        }
+    }
+};
+
+static void runEachLine(Interpreter& interpreter, std::shared_ptr<const Block> program,
+                        const std::string& source) {
+
+    LineRunner runner(interpreter, std::move(program), source);
+
+    // The script output is collected and written in big pieces too
+    std::ostringstream output;
+    interpreter.setOutput(output);
+
+    auto flushOutput = [&output] {
+        std::cout << output.str();
+        output.str("");
+    };
+
+    // Our buffer replaces the one of stdin
+    std::setvbuf(stdin, nullptr, _IONBF, 0);
+
+    std::vector<char> buffer(eachLineBlock);
+    size_t kept = 0;    // Start of an unfinished line, moved to the front
+
+    while (true) {
+
+        // A line longer than the buffer: make room for it
+        if (kept == buffer.size())
+            buffer.resize(buffer.size() * 2);
+
+        size_t got = std::fread(buffer.data() + kept, 1, buffer.size() - kept, stdin);
+        size_t size = kept + got;
+        const char* data = buffer.data();
+        size_t start = 0;
+
+        while (const char* newline = (const char*)std::memchr(data + start, '\n', size - start)) {
+
+            runner.run(std::string_view(data + start, newline - data - start));
+            start = newline - data + 1;
+
+            if ((size_t)output.tellp() >= eachLineBlock)
+                flushOutput();
+        }
+
+        if (got == 0) {
+
+            // Last line without a newline
+            if (start < size)
+                runner.run(std::string_view(data + start, size - start));
+
+            break;
+        }
+
+        kept = size - start;
+        std::memmove(buffer.data(), data + start, kept);
+    }
+
+    flushOutput();
+    std::cout << std::flush;
+    interpreter.setOutput(std::cout);
+}
+
+#ifdef __linux__
+
+// ===============================
+// Watch Mode (--watch)
+// ===============================
+// Runs a script, then runs it again every time the file is saved.
+// Only the changed statements are parsed again. A run that is still
+// going when the file changes is stopped at its next loop back-edge
+// and started over with the new version.
+
+// Wait for a change to `name`: forever if `timeout` is -1, otherwise
+// at most `timeout` milliseconds (0 just checks)
+static bool scriptChanged(int watchFd, const std::string& name, int timeout) {
+
+    bool changed = false;
+
+    while (!changed) {
+
+        pollfd request{ watchFd, POLLIN, 0 };
+
+        if (poll(&request, 1, timeout) <= 0)
+            return false;
+
+        alignas(inotify_event) char buffer[4096];
+        ssize_t length = read(watchFd, buffer, sizeof(buffer));
+
+        for (ssize_t pos = 0; pos < length; ) {
+
+            const inotify_event* event = (const inotify_event*)(buffer + pos);
+
+            if (event->len > 0 && name == event->name)
+                changed = true;
+
+            pos += sizeof(inotify_event) + event->len;
+        }
+
+        // Another file changed: let the caller work out the time left
+        if (!changed && timeout >= 0)
+            return false;
+    }
+
+    // Editors often save in several steps; let them finish
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    char buffer[4096];
+    while (read(watchFd, buffer, sizeof(buffer)) > 0) {}
+
+    return true;
+}
+
+static int watchScript(const std::string& path, const Variables& params, long slice) {
+
+    std::filesystem::path file(path);
+    std::string directory = file.has_parent_path() ? file.parent_path().string() : ".";
+    std::string name = file.filename().string();
+
+    // Watch the folder, because many editors save by replacing the file
+    int watchFd = inotify_init1(IN_NONBLOCK);
+
+    if (watchFd < 0 ||
+        inotify_add_watch(watchFd, directory.c_str(),
+                          IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0) {
+        std::cout << "Error: could not watch " << path << "\n";
+        return 1;
+    }
+
+    IncrementalParser parser;
+    bool first = true;
+
+    while (true) {
+
+        std::string code;
+        bool restarted = false;
+
+        if (!readFile(path, code)) {
+            std::cout << "Error: Could not open file.\n";
+        }
+        else {
+
+            auto program = parser.parse(code);
+
+            if (!first)
+                std::cout << "--- reloaded " << path << " (" << parser.reused << " of "
+                          << parser.total << " statements unchanged) ---\n";
+            first = false;
+
+            Interpreter interpreter;
+
+            for (const auto& param : params)
+                interpreter.setVariable(param.first, param.second);
+
+            interpreter.load(program);
+
+            // Run in slices so an edit can interrupt a long run. While
+            // the script sleeps or waits for a timer, wait for an edit
+            // until it is time to go on.
+            while (!interpreter.run(slice)) {
+
+                int timeout = 0;
+
+                if (interpreter.isWaiting()) {
+                    auto left = interpreter.wakeTime() - std::chrono::steady_clock::now();
+                    timeout = (int)std::max<long long>(0,
+                        std::chrono::ceil<std::chrono::milliseconds>(left).count());
+                }
+
+                if (scriptChanged(watchFd, name, timeout)) {
+                    restarted = true;
+                    break;
+                }
+            }
+        }
+
+        std::cout.flush();
+
+        if (!restarted)
+            scriptChanged(watchFd, name, -1);
+    }
+}
+
+#endif
+
+// ===============================
+// Bundled Scripts (--bundle)
+// ===============================
+// `--bundle script.txt -o tool` copies this executable and writes the
+// script, already parsed and compiled to bytecode, into the copy's
+// .nanbundle section. When the copy starts it runs the script straight
+// from its own loaded memory: no file is opened, nothing is read from
+// disk and nothing is parsed. The script text is kept next to the
+// bytecode because checkpoints and profiles are tied to it.
+
+// ============================================
+// Write a parsed program as bytes
+// ============================================
+// Every block, starting with the top one: statement count, then for each
+// statement its kind, line number, text, code offset, loop variable,
+// loop count, condition and whether it has a body (followed by the
+// body, in the same layout); then the block's bytecode, constants and
+// match patterns. Bodies are parsed here if they were not yet.
+static void writeProgram(const Block& block, BinaryWriter& writer) {
+
+    writer.number(block.statements.size());
+
+    for (const Statement& statement : block.statements) {
+
+        writer.number(statement.kind);
+        writer.number(statement.lineNumber);
+        writer.text(statement.text);
+        writer.number(statement.codeOffset);
+        writer.text(statement.loopVar);
+        writer.signedNumber(statement.loopCount);
+        writer.text(statement.condition);
+        writer.number(statement.body ? 1 : 0);
+
+        if (statement.body)
+            writeProgram(statement.body->get(), writer);
+    }
+
+    writer.text(block.code);
+
+    writer.number(block.constants.size());
+    for (const std::string& constant : block.constants)
+        writer.text(constant);
+
+    writer.number(block.patterns.size());
+    for (const auto& pattern : block.patterns)
+        writer.text(pattern->pattern());
+}
+
+// Read a program written by writeProgram; nullptr if it is damaged
+static std::shared_ptr<const Block> readProgram(BinaryReader& reader, int depth = 0) {
+
+    // Deeper than any script could nest
+    if (depth > 10000)
+        return nullptr;
+
+    auto block = std::make_shared<Block>();
+    uint64_t count = reader.number();
+
+    for (uint64_t i = 0; i < count && reader.ok; i++) {
+
+        Statement statement;
+        uint64_t kind = reader.number();
+
+        if (kind > Statement::BadLoop)
+            return nullptr;
+
+        statement.kind = (Statement::Kind)kind;
+        statement.lineNumber = (int)reader.number();
+        statement.text = reader.text();
+        statement.codeOffset = (uint32_t)reader.number();
+        statement.loopVar = reader.text();
+        statement.loopCount = (int)reader.signedNumber();
+        statement.condition = reader.text();
+
+        if (reader.number()) {
+
+            auto body = readProgram(reader, depth + 1);
+
+            if (!body)
+                return nullptr;
+
+            statement.body = std::make_shared<LazyBlock>(std::move(body));
+        }
+
+        block->statements.push_back(std::move(statement));
+    }
+
+    block->code = reader.text();
+
+    uint64_t constants = reader.number();
+    for (uint64_t i = 0; i < constants && reader.ok; i++)
+        block->constants.push_back(reader.text());
+
+    uint64_t patterns = reader.number();
+    for (uint64_t i = 0; i < patterns && reader.ok; i++)
+        block->patterns.push_back(std::make_shared<Regex>(reader.text()));
+
+    if (!reader.ok)
+        return nullptr;
+
+    for (const Statement& statement : block->statements)
+        if (statement.kind == Statement::Line && statement.codeOffset >= block->code.size())
+            return nullptr;
+
+    return block;
+}
+
+#ifndef NAN_BUNDLE_CAPACITY
+#define NAN_BUNDLE_CAPACITY (64 * 1024)
+#endif
+
+struct BundleSlot {
+    uint64_t size;                      // 0 = nothing bundled
+    char code[NAN_BUNDLE_CAPACITY];
+};
+
+// Not static: the compiler must not assume the slot stays empty
+#if defined(__GNUC__) && defined(__ELF__)
+__attribute__((section(".nanbundle"), used))
+#endif
+BundleSlot nanBundle = { 0, { 0 } };
+
+// The bundled script and its compiled program, or false if this
+// executable has none. The bundle holds the script text, then the
+// program (see writeProgram).
+static bool bundledScript(std::string& source, std::shared_ptr<const Block>& program) {
+
+    // Read through volatile so the empty initial value is never folded in
+    const volatile uint64_t* size = &nanBundle.size;
+
+    if (*size == 0 || *size > NAN_BUNDLE_CAPACITY)
+        return false;
+
+    BinaryReader reader(nanBundle.code, *size);
+
+    source = reader.text();
+    program = readProgram(reader);
+
+    return reader.ok && program;
+}
+
+// Write a copy of this executable with `source` (compiled) in its
+// bundle section
+static int writeBundle(const std::string& source, const std::string& outputPath) {
+
+#ifdef __linux__
+    BinaryWriter bundle;
+    bundle.text(source);
+    writeProgram(*Interpreter::compile(source), bundle);
+
+    const std::string& code = bundle.data;
+
+    if (code.size() > NAN_BUNDLE_CAPACITY) {
+        std::cout << "Error: compiled script is larger than the bundle capacity ("
+                  << NAN_BUNDLE_CAPACITY << " bytes)\n";
+        return 1;
+    }
+
+    std::string image;
+
+    if (!readFile("/proc/self/exe", image) || image.size() < sizeof(Elf64_Ehdr)) {
+        std::cout << "Error: could not read the running executable\n";
+        return 1;
+    }
+
+    // Find the .nanbundle section through the ELF section headers
+    Elf64_Ehdr header;
+    std::copy_n(image.data(), sizeof(header), (char*)&header);
+
+    bool valid = image.compare(0, SELFMAG, ELFMAG) == 0 &&
+                 header.e_ident[EI_CLASS] == ELFCLASS64 &&
+                 header.e_shentsize == sizeof(Elf64_Shdr) &&
+                 header.e_shoff + (uint64_t)header.e_shnum * sizeof(Elf64_Shdr) <= image.size() &&
+                 header.e_shstrndx < header.e_shnum;
+
+    uint64_t slotOffset = 0;
+
+    for (int i = 0; valid && i < header.e_shnum && slotOffset == 0; i++) {
+
+        Elf64_Shdr section, names;
+        std::copy_n(image.data() + header.e_shoff + i * sizeof(Elf64_Shdr),
+                    sizeof(section), (char*)&section);
+        std::copy_n(image.data() + header.e_shoff + header.e_shstrndx * sizeof(Elf64_Shdr),
+                    sizeof(names), (char*)&names);
+
+        uint64_t nameOffset = names.sh_offset + section.sh_name;
+
+        if (nameOffset < image.size() &&
+            std::string(image.c_str() + nameOffset) == ".nanbundle" &&
+            section.sh_type == SHT_PROGBITS &&
+            section.sh_size >= sizeof(BundleSlot) &&
+            section.sh_offset + sizeof(BundleSlot) <= image.size())
+            slotOffset = section.sh_offset;
+    }
+
+    if (slotOffset == 0) {
+        std::cout << "Error: this executable has no bundle section\n";
+        return 1;
+    }
+
+    uint64_t size = code.size();
+    std::copy_n((const char*)&size, sizeof(size), &image[slotOffset]);
+    std::fill_n(&image[slotOffset + sizeof(size)], NAN_BUNDLE_CAPACITY, '\0');
+    code.copy(&image[slotOffset + sizeof(size)], code.size());
+
+    {
+        std::ofstream file(outputPath, std::ios::binary | std::ios::trunc);
+
+        if (!file.write(image.data(), image.size())) {
+            std::cout << "Error: could not write " << outputPath << "\n";
+            return 1;
+        }
+    }
+
+    chmod(outputPath.c_str(), 0755);
+
+    return 0;
+#else
+    (void)source;
+    (void)outputPath;
+    std::cout << "Error: --bundle is only supported for Linux executables\n";
+    return 1;
+#endif
+}
+
+// ============================================
+// Show how to use the program
+// ============================================
+static void printUsage() {
+    std::cout << "Usage: mini_lang [options] <filename.txt> [more.txt ...]\n"
+              << "  --slice N              statements a script may run before it yields\n"
+              << "  --workers N            threads used to run several scripts or requests\n"
+              << "  --param name=value     set a variable before the script starts\n"
+              << "  --serve socket         run as a server on a Unix socket\n"
+              << "  --request-timeout s    longest time a server request may run (default 30)\n"
+              << "  --client socket        send the script (or -e code) to a server\n"
+              << "  -e code                inline script, for --client\n"
+              << "  --cache-dir dir        replay results of deterministic scripts from dir\n"
+              << "  --checkpoint-file f    where checkpoints are saved (default <script>.snapshot)\n"
+              << "  --checkpoint-every N   save a checkpoint every N statements\n"
+              << "  --resume f             continue a script from a checkpoint\n"
+              << "  --save-snapshot f      save the variables when the script ends\n"
+              << "  --snapshot f           start with the variables saved in f\n"
+              << "  --bundle script -o f   build a standalone executable running the script\n"
+              << "  --watch                run the script again every time it is saved\n"
+              << "  --record-profile f     count how often every loop and if runs\n"
+              << "  --use-profile f        prepare the script using a recorded profile\n"
+              << "  --perf-counters        show CPU counters (cycles, cache misses...) per loop\n"
+              << "  --each-line            run the script once for every line of stdin\n"
+              << "  --shard-procs N        run every ploop in N worker processes\n";
+}
+
+// ============================================
+// MAIN FUNCTION
 // ============================================
 int main(int argc, char* argv[]) {
 
+    long slice = 10000;
+    int workers = 0;    // 0 = pick a default below
+    std::vector<std::string> files;
+    Variables params;
+    std::string serveSocket;
+    int requestTimeout = 30;
+    std::string clientSocket;
+    std::string inlineCode;
+    bool hasInlineCode = false;
+    std::string cacheDir;
+    std::string checkpointFile;
+    long checkpointEvery = 0;
+    std::string resumeFile;
+    std::string saveSnapshotFile;
+    std::string snapshotFile;
+    std::string bundleFile;
+    std::string outputFile;
+    bool watch = false;
+    std::string recordProfileFile;
+    std::string useProfileFile;
+    bool perfCounters = false;
+    int shardProcs = 1;
+    bool eachLine = false;
+
+    // Options followed by a value
+    static const char* valueOptions[] = {
+        "--slice", "--workers", "--param", "--serve", "--request-timeout", "--client",
+        "--cache-dir", "--checkpoint-file", "--checkpoint-every", "--resume",
+        "--save-snapshot", "--snapshot", "--bundle", "-o", "--record-profile",
+        "--use-profile", "--shard-procs", "-e"
+    };
+
+    // Threads and worker processes are capped, so a typo can not ask
+    // for billions of them
+    static const long maxWorkers = 1024;
+
+    // Read the number after option `i` into `value`
+    auto number = [&](int& i, long low, long high, long& value) {
+
+        std::string option = argv[i];
+
+        if (parseOptionNumber(argv[++i], low, high, value))
+            return true;
+
+        std::cout << "Error: " << option << " expects a whole number from " << low
+                  << " to " << high << "\n";
+        printUsage();
+        return false;
+    };
+
+    // Read options and file names
+    for (int i = 1; i < argc; i++) {
+
+        std::string arg = argv[i];
+        long value = 0;
+
+        bool takesValue = false;
+
+        for (const char* name : valueOptions)
+            takesValue = takesValue || arg == name;
+
+        if (takesValue && i + 1 >= argc) {
+            std::cout << "Error: " << arg << " expects a value\n";
+            printUsage();
+            return 1;
+        }
+
+        if (arg == "--slice") {
+            if (!number(i, 1, LONG_MAX, slice))
+                return 1;
+        }
+        else if (arg == "--workers") {
+            if (!number(i, 0, maxWorkers, value))
+                return 1;
+            workers = (int)value;
+        }
+        else if (arg == "--param") {
+            if (!parseParam(argv[++i], params)) {
+                std::cout << "Error: --param expects name=value\n";
+                return 1;
+            }
+        }
+        else if (arg == "--serve") {
+            serveSocket = argv[++i];
+        }
+        else if (arg == "--request-timeout") {
+            if (!number(i, 1, INT_MAX, value))
+                return 1;
+            requestTimeout = (int)value;
+        }
+        else if (arg == "--client") {
+            clientSocket = argv[++i];
+        }
+        else if (arg == "--cache-dir") {
+            cacheDir = argv[++i];
+        }
+        else if (arg == "--checkpoint-file") {
+            checkpointFile = argv[++i];
+        }
+        else if (arg == "--checkpoint-every") {
+            if (!number(i, 1, LONG_MAX, checkpointEvery))
+                return 1;
+        }
+        else if (arg == "--resume") {
+            resumeFile = argv[++i];
+        }
+        else if (arg == "--save-snapshot") {
+            saveSnapshotFile = argv[++i];
+        }
+        else if (arg == "--snapshot") {
+            snapshotFile = argv[++i];
+        }
+        else if (arg == "--bundle") {
+            bundleFile = argv[++i];
+        }
+        else if (arg == "-o") {
+            outputFile = argv[++i];
+        }
+        else if (arg == "--record-profile") {
+            recordProfileFile = argv[++i];
+        }
+        else if (arg == "--use-profile") {
+            useProfileFile = argv[++i];
+        }
+        else if (arg == "--each-line") {
+            eachLine = true;
+        }
+        else if (arg == "--perf-counters") {
+            perfCounters = true;
+        }
+        else if (arg == "--shard-procs") {
+            if (!number(i, 1, maxWorkers, value))
+                return 1;
+            shardProcs = (int)value;
+        }
+        else if (arg == "--watch") {
+            watch = true;
+        }
+        else if (arg == "-e") {
+            inlineCode = argv[++i];
+            hasInlineCode = true;
+        }
+        else if (arg.size() > 1 && arg[0] == '-') {
+            std::cout << "Error: unknown option " << arg << "\n";
+            printUsage();
+            return 1;
+        }
+        else {
+            files.push_back(arg);
+        }
+    }
+
+
+    // Build a standalone executable
+    if (!bundleFile.empty()) {
+
+        std::string code;
+
+        if (outputFile.empty() || !files.empty()) {
+            printUsage();
+            return 1;
+        }
+
+        if (!readFile(bundleFile, code)) {
+            std::cout << "Error: Could not open file.\n";
+            return 1;
+        }
+
+        return writeBundle(code, outputFile);
+    }
+
+    // This executable carries its own script: run it, the command line
+    // only holds options
+    std::string bundled;
+    std::shared_ptr<const Block> bundledProgram;
+
+    if (bundledScript(bundled, bundledProgram)) {
+
+        if (!files.empty()) {
+            printUsage();
+            return 1;
+        }
+
+        files.push_back(argv[0]);
+    }
+
+    // Server and client modes
+    if (!serveSocket.empty() || !clientSocket.empty()) {
+
+#ifndef _WIN32
+        if (!serveSocket.empty()) {
+            if (workers == 0)
+                workers = std::max(1u, std::thread::hardware_concurrency());
+
+            return serve(serveSocket, workers, requestTimeout);
+        }
+
+        if (files.size() + (hasInlineCode ? 1 : 0) != 1) {
+            printUsage();
+            return 1;
+        }
+
+        std::ostringstream request;
+
+        for (const auto& param : params)
+            request << "param " << param.first << " " << param.second << "\n";
+
+        if (hasInlineCode) {
+            request << "source\n" << inlineCode << "\n";
+        }
+        else {
+            // The server has its own working directory
+            char fullPath[PATH_MAX];
+
+            if (!realpath(files[0].c_str(), fullPath)) {
+                std::cout << "Error: Could not open file.\n";
+                return 1;
+            }
+
+            request << "path " << fullPath << "\n";
+        }
+
+        return runClient(clientSocket, request.str());
+#else
+        std::cout << "Error: --serve and --client need Unix domain sockets\n";
+        return 1;
+#endif
+    }
+
+    // Continue a checkpointed script
+    if (!resumeFile.empty()) {
+
+        // The script comes from the snapshot
+        if (files.size() > (bundled.empty() ? 0u : 1u)) {
+            std::cout << "Error: --resume takes the script from the snapshot, not from "
+                      << files.back() << "\n";
+            return 1;
+        }
+
+        std::string snapshot;
+        std::string source;
+        OutputPosition output;
+
+        Interpreter interpreter;
+
+        if (!readFile(resumeFile, snapshot) ||
+            !interpreter.restoreState(snapshot, source, output)) {
+            std::cout << "Error: could not resume from " << resumeFile << "\n";
+            return 1;
+        }
+
+#ifndef _WIN32
+        // When stdout is the same file as before, drop what the stopped run
+        // printed after the checkpoint, so it is not printed twice
+        struct stat info;
+
+        if (output.offset >= 0 && fstat(STDOUT_FILENO, &info) == 0 &&
+            (uint64_t)info.st_dev == output.device &&
+            (uint64_t)info.st_ino == output.inode &&
+            ftruncate(STDOUT_FILENO, output.offset) == 0)
+            lseek(STDOUT_FILENO, output.offset, SEEK_SET);
+#endif
+
+        interpreter.setCheckpoint(checkpointFile.empty() ? resumeFile : checkpointFile,
+                                  source, checkpointEvery);
+        interpreter.setShardProcesses(shardProcs);
+        interpreter.run();
+
+        return 0;
+    }
+
     // Check if filename was provided
-    if (argc < 2) {
-        std::cout << "Usage: mini_lang <filename.txt>\n";
+    if (files.empty()) {
+        printUsage();
         return 1;
     }
 
-    // Try to open file
-    std::ifstream file(argv[1]);
+    if (workers == 0)
+        workers = 1;
+
+    // These options belong to one script; several scripts run through
+    // the scheduler, and --watch restarts a plain run, neither of which
+    // has them
+    std::string singleOption = !cacheDir.empty() ? "--cache-dir"
+                             : checkpointEvery > 0 ? "--checkpoint-every"
+                             : !checkpointFile.empty() ? "--checkpoint-file"
+                             : !snapshotFile.empty() ? "--snapshot"
+                             : !saveSnapshotFile.empty() ? "--save-snapshot"
+                             : !recordProfileFile.empty() ? "--record-profile"
+                             : !useProfileFile.empty() ? "--use-profile"
+                             : perfCounters ? "--perf-counters"
+                             : shardProcs > 1 ? "--shard-procs"
+                             : eachLine ? "--each-line"
+                             : "";
 
-    if (!file.is_open()) {
-        std::cout << "Error: Could not open file.\n";
+    if (!singleOption.empty() && files.size() > 1) {
+        std::cout << "Error: " << singleOption << " works with one script only\n";
         return 1;
     }
 
-    // Read entire file into a string
-    std::stringstream buffer;
-    buffer << file.rdbuf();
+    if (!singleOption.empty() && watch) {
+        std::cout << "Error: " << singleOption << " does not work with --watch\n";
+        return 1;
+    }
 
-    // Create interpreter instance
-    Interpreter interpreter;
+    if (watch) {
+
+        if (files.size() != 1) {
+            printUsage();
+            return 1;
+        }
+
+#ifdef __linux__
+        return watchScript(files[0], params, slice);
+#else
+        std::cout << "Error: --watch is only supported on Linux\n";
+        return 1;
+#endif
+    }
+
+    // Read every script up front
+    std::vector<std::string> sources(files.size());
+
+    if (!bundled.empty())
+        sources[0] = bundled;
+
+    for (size_t i = bundled.empty() ? 0 : 1; i < files.size(); i++) {
+        if (!readFile(files[i], sources[i])) {
+            std::cout << "Error: Could not open file.\n";
+            return 1;
+        }
+    }
+
+    // One script: run it directly
+    if (sources.size() == 1 && (workers == 1 || !singleOption.empty() || bundledProgram)) {
+
+        // Create interpreter instance
+        Interpreter interpreter;
+
+        // Start from a saved setup
+        if (!snapshotFile.empty()) {
+
+            MappedFile snapshot;
+
+            if (!snapshot.open(snapshotFile) ||
+                !interpreter.loadVariables(snapshot.data(), snapshot.size())) {
+                std::cout << "Error: could not load snapshot " << snapshotFile << "\n";
+                return 1;
+            }
+        }
+
+        for (const auto& param : params)
+            interpreter.setVariable(param.first, param.second);
+
+        interpreter.setCheckpoint(checkpointFile.empty() ? files[0] + ".snapshot"
+                                                         : checkpointFile,
+                                  sources[0], checkpointEvery);
+
+        auto program = bundledProgram ? bundledProgram : Interpreter::compile(sources[0]);
+
+        if (!useProfileFile.empty()) {
+
+            LineProfile lineProfile;
+
+            if (loadProfile(useProfileFile, sources[0], lineProfile))
+                applyProfile(*program, lineProfile);
+            else
+                std::cerr << "Warning: profile " << useProfileFile
+                          << " does not match this script; ignored\n";
+        }
+
+        ProfileData profile;
+
+        if (!recordProfileFile.empty())
+            interpreter.setProfile(&profile);
+
+        interpreter.setShardProcesses(shardProcs);
+
+        std::unique_ptr<PerfCounters> counters;
+        PerfData perfData;
+
+        if (perfCounters) {
+
+            counters.reset(new PerfCounters());
+
+            if (!counters->available())
+                std::cerr << "Warning: hardware counters are not available ("
+                          << counters->whyMissing() << "); running without them\n";
+            else
+                interpreter.setPerfCounters(counters.get(), &perfData);
+        }
+
+        // Execute the script
+        if (eachLine) {
+            runEachLine(interpreter, program, sources[0]);
+        }
+        else if (!cacheDir.empty()) {
+            runCached(interpreter, program, ResultCache(cacheDir));
+        }
+        else {
+            interpreter.load(program);
+            interpreter.run();
+        }
+
+        if (counters && counters->available())
+            printPerfReport(*counters, perfData);
+
+        if (!recordProfileFile.empty() &&
+            !saveProfile(recordProfileFile, sources[0], profile)) {
+            std::cerr << "Error: could not save profile " << recordProfileFile << "\n";
+            return 1;
+        }
+
+        if (!saveSnapshotFile.empty()) {
+
+            std::ofstream file(saveSnapshotFile, std::ios::binary);
+            std::string snapshot = interpreter.saveVariables();
+
+            if (!file.write(snapshot.data(), snapshot.size())) {
+                std::cout << "Error: could not save snapshot " << saveSnapshotFile << "\n";
+                return 1;
+            }
+        }
+
+        return 0;
+    }
+
+    // Several scripts: share the workers between them
+    Scheduler scheduler(workers, slice);
+
+    for (const std::string& source : sources)
+        scheduler.add(source, params);
 
-    // Execute the script
-    interpreter.execute(buffer.str());
+    scheduler.run();
 
     return 0;
 }
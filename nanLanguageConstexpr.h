@@ -0,0 +1,398 @@
+#pragma once
+
+// ============================================
+// nanLanguage at compile time
+// ============================================
+// A header-only, constexpr subset of the interpreter. It runs a script
+// while your C++ program is being compiled, so a table generated by a
+// script can be used directly instead of being pasted into a header.
+//
+// Supported commands: set, add, sub, mult, div, print, comment,
+// loop and if (same syntax as the full interpreter).
+//
+// Example (C++17 or later):
+//
+//     #include "nanLanguageConstexpr.h"
+//
+//     constexpr auto powers = nanLanguage::evaluateOutputs<8>(R"(
+//     set p = 1
+//     loop i:8 (
+//         print p
+//         mult p 2
+//     )
+//     )");
+//
+//     static_assert(powers[7] == 128);
+//
+// Anything the full interpreter reports as an error (unknown command,
+// missing variable, division by zero...) stops the compilation here.
+
+#include <array>        // For the results
+#include <cstddef>      // For std::size_t
+#include <stdexcept>    // For reporting script errors
+#include <string_view>  // For reading the script without copies
+
+namespace nanLanguage {
+
+// ===============================
+// Lexer helpers
+// ===============================
+
+constexpr bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+constexpr bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// Remove spaces from both ends
+constexpr std::string_view trim(std::string_view text) {
+
+    while (!text.empty() && isSpace(text.front()))
+        text.remove_prefix(1);
+
+    while (!text.empty() && isSpace(text.back()))
+        text.remove_suffix(1);
+
+    return text;
+}
+
+// Take the next line from `rest` (without the newline)
+constexpr std::string_view nextLine(std::string_view& rest) {
+
+    std::size_t end = rest.find('\n');
+    std::string_view line = rest.substr(0, end);
+
+    rest.remove_prefix(end == std::string_view::npos ? rest.size() : end + 1);
+
+    return line;
+}
+
+// Take the next space-separated word from `rest`
+constexpr std::string_view nextWord(std::string_view& rest) {
+
+    while (!rest.empty() && isSpace(rest.front()))
+        rest.remove_prefix(1);
+
+    std::size_t length = 0;
+    while (length < rest.size() && !isSpace(rest[length]))
+        length++;
+
+    std::string_view word = rest.substr(0, length);
+    rest.remove_prefix(length);
+
+    return word;
+}
+
+constexpr bool isNumber(std::string_view text) {
+    return !text.empty() &&
+           (isDigit(text[0]) || (text[0] == '-' && text.size() > 1));
+}
+
+constexpr int parseNumber(std::string_view text) {
+
+    bool negative = !text.empty() && text[0] == '-';
+
+    if (negative)
+        text.remove_prefix(1);
+
+    if (text.empty())
+        throw std::invalid_argument("nanLanguage: expected a number");
+
+    int value = 0;
+
+    for (char c : text) {
+        if (!isDigit(c))
+            throw std::invalid_argument("nanLanguage: expected a number");
+        value = value * 10 + (c - '0');
+    }
+
+    return negative ? -value : value;
+}
+
+// ===============================
+// Compile-time interpreter
+// ===============================
+// Variables live in fixed-size arrays, because constexpr code can not
+// use std::map. MaxVariables and MaxOutputs are the capacities.
+template <std::size_t MaxVariables, std::size_t MaxOutputs>
+class ConstexprInterpreter {
+private:
+
+    std::array<std::string_view, MaxVariables> names{};
+    std::array<int, MaxVariables> values{};
+    std::size_t variableCount = 0;
+
+    std::array<int, MaxOutputs> printed{};
+    std::size_t printedCount = 0;
+
+public:
+
+    // ============================================
+    // Execute full script (multiple lines of code)
+    // ============================================
+    constexpr void execute(std::string_view code) {
+
+        while (!code.empty()) {
+
+            std::string_view line = nextLine(code);
+
+            if (line.empty())
+                continue;
+
+            std::string_view rest = line;
+            std::string_view command = nextWord(rest);
+
+            // =========================
+            // LOOP COMMAND
+            // =========================
+            if (command == "loop") {
+
+                // Example: i:10
+                std::string_view varAndCount = nextWord(rest);
+                std::size_t colonPos = varAndCount.find(':');
+
+                if (colonPos == std::string_view::npos)
+                    throw std::invalid_argument("nanLanguage: loop expects var:count");
+
+                std::string_view var = varAndCount.substr(0, colonPos);
+                int count = parseNumber(varAndCount.substr(colonPos + 1));
+
+                if (nextWord(rest) != "(")
+                    throw std::invalid_argument("nanLanguage: expected (");
+
+                std::string_view block = readBlock(code);
+
+                for (int i = 0; i < count; i++) {
+                    set(var, i);
+                    execute(block);
+                }
+            }
+
+            // =========================
+            // IF COMMAND
+            // =========================
+            else if (command == "if") {
+
+                std::string_view condition = trim(rest);
+
+                // Remove trailing "("
+                if (!condition.empty() && condition.back() == '(')
+                    condition = trim(condition.substr(0, condition.size() - 1));
+
+                std::string_view block = readBlock(code);
+
+                if (evaluateCondition(condition))
+                    execute(block);
+            }
+
+            else {
+                runLine(line);
+            }
+        }
+    }
+
+    // Value of a variable (an error if it does not exist)
+    constexpr int get(std::string_view name) const {
+        return values[indexOf(name)];
+    }
+
+    // Integers printed with "print variable", in order
+    constexpr int output(std::size_t index) const {
+        return index < printedCount ? printed[index] : 0;
+    }
+
+private:
+
+    constexpr std::size_t find(std::string_view name) const {
+
+        for (std::size_t i = 0; i < variableCount; i++)
+            if (names[i] == name)
+                return i;
+
+        return MaxVariables;
+    }
+
+    constexpr std::size_t indexOf(std::string_view name) const {
+
+        std::size_t index = find(name);
+
+        if (index == MaxVariables)
+            throw std::invalid_argument("nanLanguage: variable not found");
+
+        return index;
+    }
+
+    constexpr void set(std::string_view name, int value) {
+
+        std::size_t index = find(name);
+
+        if (index == MaxVariables) {
+
+            if (variableCount == MaxVariables)
+                throw std::length_error("nanLanguage: too many variables");
+
+            index = variableCount++;
+            names[index] = name;
+        }
+
+        values[index] = value;
+    }
+
+    // ============================================
+    // Execute one single line of code
+    // ============================================
+    constexpr void runLine(std::string_view line) {
+
+        std::string_view rest = line;
+        std::string_view command = nextWord(rest);
+
+        if (command == "comment")
+            return;
+
+        // print "text" has nothing to record; print x records x
+        if (command == "print") {
+
+            std::string_view text = trim(rest);
+
+            if (text.size() >= 2 && text.front() == '"' && text.back() == '"')
+                return;
+
+            std::size_t index = find(text);
+
+            // Only the first MaxOutputs values are kept
+            if (index != MaxVariables && printedCount < MaxOutputs)
+                printed[printedCount++] = values[index];
+
+            return;
+        }
+
+        // set x = 5  /  set x = y
+        if (command == "set") {
+
+            std::string_view var = nextWord(rest);
+            std::string_view valueToken = nextWord(rest);
+
+            if (valueToken == "=")
+                valueToken = nextWord(rest);
+
+            if (isNumber(valueToken))
+                set(var, parseNumber(valueToken));
+            else
+                set(var, get(valueToken));
+
+            return;
+        }
+
+        // add / sub / mult / div x number
+        if (command == "add" || command == "sub" ||
+            command == "mult" || command == "div") {
+
+            std::size_t index = indexOf(nextWord(rest));
+            int value = parseNumber(nextWord(rest));
+
+            if (command == "add")  values[index] += value;
+            if (command == "sub")  values[index] -= value;
+            if (command == "mult") values[index] *= value;
+
+            if (command == "div") {
+                if (value == 0)
+                    throw std::domain_error("nanLanguage: division by zero");
+                values[index] /= value;
+            }
+
+            return;
+        }
+
+        throw std::invalid_argument("nanLanguage: unknown command");
+    }
+
+    constexpr int operand(std::string_view token) const {
+
+        std::size_t index = find(token);
+
+        return index != MaxVariables ? values[index] : parseNumber(token);
+    }
+
+    constexpr bool evaluateCondition(std::string_view condition) const {
+
+        int left = operand(nextWord(condition));
+        std::string_view op = nextWord(condition);
+        int right = operand(nextWord(condition));
+
+        if (op == ">")  return left > right;
+        if (op == "<")  return left < right;
+        if (op == ">=") return left >= right;
+        if (op == "<=") return left <= right;
+        if (op == "==") return left == right;
+        if (op == "!=") return left != right;
+
+        throw std::invalid_argument("nanLanguage: invalid operator in condition");
+    }
+
+    // Take the lines of a block up to its closing ")"
+    static constexpr std::string_view readBlock(std::string_view& code) {
+
+        std::string_view start = code;
+        int depth = 1;
+
+        while (!code.empty()) {
+
+            std::size_t blockSize = start.size() - code.size();
+            std::string_view line = nextLine(code);
+
+            for (char c : line) {
+                if (c == '(') depth++;
+                else if (c == ')') depth--;
+            }
+
+            if (depth == 0)
+                return start.substr(0, blockSize);
+        }
+
+        return start;
+    }
+};
+
+// ============================================
+// Run a script and return what it printed
+// ============================================
+// The first N integers printed with "print variable".
+// Missing values are 0.
+template <std::size_t N, std::size_t MaxVariables = 64>
+constexpr std::array<int, N> evaluateOutputs(std::string_view script) {
+
+    ConstexprInterpreter<MaxVariables, N> interpreter;
+    interpreter.execute(script);
+
+    std::array<int, N> result{};
+
+    for (std::size_t i = 0; i < N; i++)
+        result[i] = interpreter.output(i);
+
+    return result;
+}
+
+// ============================================
+// Run a script and return some of its variables
+// ============================================
+// Example:
+//     constexpr std::array<std::string_view, 2> names = { "x", "y" };
+//     constexpr auto v = nanLanguage::evaluateVariables(script, names);
+template <std::size_t N, std::size_t MaxVariables = 64>
+constexpr std::array<int, N> evaluateVariables(std::string_view script,
+                                               const std::array<std::string_view, N>& names) {
+
+    ConstexprInterpreter<MaxVariables, 1> interpreter;
+    interpreter.execute(script);
+
+    std::array<int, N> result{};
+
+    for (std::size_t i = 0; i < N; i++)
+        result[i] = interpreter.get(names[i]);
+
+    return result;
+}
+
+} // namespace nanLanguage
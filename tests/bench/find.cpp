@@ -0,0 +1,75 @@
+// Times findText (the SSE2 first/last byte search behind find, contains
+// and split) against std::string_view::find on long log-like lines.
+// Built by tests/bench/find.sh; it includes the interpreter itself, so
+// the search it measures is exactly the one scripts use.
+
+#define main nanLanguageMain
+#include "../../nanLanguage.cpp"
+#undef main
+
+#include <cstdio>
+
+// Milliseconds to search every line `rounds` times with `search`
+template <typename Search>
+static double timeSearch(const std::vector<std::string>& lines, std::string_view needle,
+                         int rounds, size_t& hits, Search search) {
+
+    auto start = std::chrono::steady_clock::now();
+    hits = 0;
+
+    for (int round = 0; round < rounds; round++)
+        for (const std::string& line : lines)
+            hits += search(std::string_view(line), needle) != std::string_view::npos;
+
+    std::chrono::duration<double, std::milli> took = std::chrono::steady_clock::now() - start;
+
+    return took.count();
+}
+
+int main() {
+
+    // 2000 lines of about 4 KB made of log-like words; one line in ten
+    // ends with the needle
+    std::vector<std::string> lines;
+    uint32_t seed = 7;
+    const char* words[] = { "GET", "POST", "/api/v1/items/", "200", "404", "host",
+                            "user=", "session", "latency_ms=", "ok", "error" };
+
+    for (int i = 0; i < 2000; i++) {
+
+        std::string line;
+
+        while (line.size() < 4096) {
+            seed = seed * 1103515245 + 12345;
+            line += words[(seed >> 16) % 11];
+            line += ' ';
+        }
+
+        if (i % 10 == 0)
+            line += "timeout_exceeded";
+
+        lines.push_back(line);
+    }
+
+    const char* needles[] = { "timeout_exceeded", "session expired", "zq" };
+
+    for (const char* needle : needles) {
+
+        size_t hitsSimd = 0;
+        size_t hitsStd = 0;
+
+        double simd = timeSearch(lines, needle, 50, hitsSimd, findText);
+        double standard = timeSearch(lines, needle, 50, hitsStd,
+                                     [](std::string_view text, std::string_view what) {
+                                         return text.find(what);
+                                     });
+
+        double megabytes = 50.0 * lines.size() * 4096 / 1e6;
+
+        std::printf("%-18s findText %7.1f ms (%5.0f MB/s)   std::find %7.1f ms (%5.0f MB/s)%s\n",
+                    needle, simd, megabytes / simd * 1000, standard, megabytes / standard * 1000,
+                    hitsSimd == hitsStd ? "" : "   RESULTS DIFFER");
+    }
+
+    return 0;
+}
@@ -0,0 +1,14 @@
+#!/bin/sh
+# Builds and runs tests/bench/find.cpp: findText against
+# std::string_view::find on long lines.
+#
+# Usage: tests/bench/find.sh      (CXX and CXXFLAGS pick the compiler)
+
+here=$(cd "$(dirname "$0")" && pwd)
+build=$(mktemp -d)
+
+trap 'rm -rf "$build"' EXIT
+
+${CXX:-g++} -std=c++17 -O2 -pthread $CXXFLAGS "$here/find.cpp" -o "$build/find" || exit 1
+
+"$build/find"
@@ -0,0 +1,66 @@
+#!/bin/sh
+# Compares the time to run a tiny script by starting a new process for
+# every run (fork + exec, parse, run) with sending it to a --serve
+# server (--client process, and, with python3, a plain socket round
+# trip without any process start).
+#
+# Usage: tests/bench/latency.sh [runs]   (default 200; CXX picks the compiler)
+
+here=$(cd "$(dirname "$0")" && pwd)
+source="$here/../../nanLanguage.cpp"
+build=$(mktemp -d)
+runs=${1:-200}
+
+${CXX:-g++} -std=c++17 -O2 -pthread "$source" -o "$build/nanLanguage" || exit 1
+
+cat > "$build/tiny.txt" <<'SCRIPT'
+set x = 2
+add x 3
+print x
+SCRIPT
+
+socket="$build/nan.sock"
+"$build/nanLanguage" --serve "$socket" --workers 2 > /dev/null 2>&1 &
+server=$!
+trap 'kill $server 2> /dev/null; rm -rf "$build"' EXIT
+
+while [ ! -S "$socket" ]; do sleep 0.05; done
+
+now() { date +%s%N; }
+
+# time_runs <label> <command...>: average microseconds per run
+time_runs() {
+    label=$1
+    shift
+    start=$(now)
+    i=0
+    while [ $i -lt "$runs" ]; do
+        "$@" > /dev/null
+        i=$((i + 1))
+    done
+    end=$(now)
+    echo "$label: $(( (end - start) / runs / 1000 )) us per run"
+}
+
+# What starting any process from this shell costs, for reference
+time_runs "process (true)  " env true
+time_runs "fork + exec     " "$build/nanLanguage" "$build/tiny.txt"
+time_runs "--client        " "$build/nanLanguage" --client "$socket" "$build/tiny.txt"
+
+if command -v python3 > /dev/null; then
+    python3 - "$socket" "$build/tiny.txt" "$runs" <<'PYTHON'
+import socket, sys, time
+path, script, runs = sys.argv[1], sys.argv[2], int(sys.argv[3])
+request = ("path " + script + "\n").encode()
+start = time.perf_counter()
+for _ in range(runs):
+    s = socket.socket(socket.AF_UNIX)
+    s.connect(path)
+    s.sendall(request)
+    s.shutdown(socket.SHUT_WR)
+    while s.recv(4096):
+        pass
+    s.close()
+print("socket round trip: %d us per run" % ((time.perf_counter() - start) / runs * 1e6))
+PYTHON
+fi
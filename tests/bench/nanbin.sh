@@ -0,0 +1,66 @@
+#!/bin/sh
+# Round trip of an array of N numbers: writing it as text (one number a
+# line) and reading it back with readint, against save / load with the
+# .nanbin format (plain, verified and compressed).
+#
+# Usage: tests/bench/nanbin.sh [N]   (default 1000000; CXX picks the compiler)
+
+here=$(cd "$(dirname "$0")" && pwd)
+source="$here/../../nanLanguage.cpp"
+build=$(mktemp -d)
+n=${1:-1000000}
+
+trap 'rm -rf "$build"' EXIT
+
+${CXX:-g++} -std=c++17 -O2 -pthread "$source" -o "$build/nanLanguage" || exit 1
+cd "$build" || exit 1
+
+fill="array a $n
+loop i:$n (
+    set x = i
+    mult x 7
+    put a i x
+)"
+
+# The array to save comes from a file, so making it costs almost nothing
+printf '%s\n' "$fill" 'save a "seed.nanbin"' > fill.txt
+fill='load a "seed.nanbin"'
+
+printf '%s\n' "$fill" 'open f "a.txt" write' "loop i:$n (" '    get a i x' '    write f x' ')' \
+    'close f' > save_text.txt
+
+printf '%s\n' "$fill" 'save a "a.nanbin"' > save_nanbin.txt
+printf '%s\n' "$fill" 'save a "c.nanbin" compressed' > save_compressed.txt
+
+printf '%s\n' "array b $n" 'open f "a.txt" read' "loop i:$n (" '    readint f x' '    put b i x' ')' \
+    'get b 7 x' 'print x' > load_text.txt
+
+printf '%s\n' 'load b "a.nanbin"' 'get b 7 x' 'print x' > load_nanbin.txt
+printf '%s\n' 'load b "a.nanbin" verify' 'get b 7 x' 'print x' > load_verify.txt
+printf '%s\n' 'load b "c.nanbin"' 'get b 7 x' 'print x' > load_compressed.txt
+
+# run <script>: milliseconds it took (the best of 3 runs)
+run() {
+    best=
+    for try in 1 2 3; do
+        start=$(date +%s%N)
+        ./nanLanguage "$1" > /dev/null
+        end=$(date +%s%N)
+        took=$(( (end - start) / 1000000 ))
+        if [ -z "$best" ] || [ "$took" -lt "$best" ]; then
+            best=$took
+        fi
+    done
+    echo "$best"
+}
+
+./nanLanguage fill.txt
+
+echo "$n numbers"
+echo "save as text            $(run save_text.txt) ms   $(wc -c < a.txt) bytes"
+echo "save .nanbin            $(run save_nanbin.txt) ms   $(wc -c < a.nanbin) bytes"
+echo "save .nanbin compressed $(run save_compressed.txt) ms   $(wc -c < c.nanbin) bytes"
+echo "load text (readint)     $(run load_text.txt) ms"
+echo "load .nanbin            $(run load_nanbin.txt) ms"
+echo "load .nanbin verify     $(run load_verify.txt) ms"
+echo "load .nanbin compressed $(run load_compressed.txt) ms"
@@ -0,0 +1,46 @@
+#!/bin/sh
+# Times a large rule script (3000 simple lines and 300 ifs in a loop
+# body, 400 variables) to see how the bytecode copes with big programs.
+# With hardware counters available, --perf-counters also shows the
+# cache misses of the loop.
+#
+# Usage: tests/bench/rules.sh      (CXX and CXXFLAGS pick the compiler)
+
+here=$(cd "$(dirname "$0")" && pwd)
+source="$here/../../nanLanguage.cpp"
+build=$(mktemp -d)
+
+trap 'rm -rf "$build"' EXIT
+
+${CXX:-g++} -std=c++17 -O2 -pthread $CXXFLAGS "$source" -o "$build/nanLanguage" || exit 1
+
+awk 'BEGIN {
+    srand(3)
+    for (v = 0; v < 400; v++)
+        print "set v" v " = " v
+    print "set hits = 0"
+    print "loop r:300 ("
+    for (k = 0; k < 3000; k++) {
+        a = int(rand() * 400)
+        op = int(rand() * 3)
+        if (op == 0)
+            print "    set v" a " = v" int(rand() * 400)
+        else
+            print "    " (op == 1 ? "add" : "sub") " v" a " " int(rand() * 8) + 1
+        if (k % 10 == 0) {
+            print "    if v" a " > " int(rand() * 500) " ("
+            print "        add hits 1"
+            print "    )"
+        }
+    }
+    print ")"
+    print "print hits"
+}' > "$build/rules.txt"
+
+start=$(date +%s%N)
+"$build/nanLanguage" "$build/rules.txt" > /dev/null
+end=$(date +%s%N)
+
+echo "rules.txt: $(( (end - start) / 1000000 )) ms"
+
+"$build/nanLanguage" --perf-counters "$build/rules.txt" 2>&1 > /dev/null | head -20
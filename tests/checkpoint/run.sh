@@ -0,0 +1,49 @@
+#!/bin/sh
+# Takes a checkpoint in the middle of a loop that reads one file and
+# writes another, lets the run go on to the end, then resumes from the
+# checkpoint. The resumed run must cut the written file and stdout back
+# to the checkpoint and finish them exactly like the first run
+# (tests/checkpoint/expected).
+#
+# Usage: tests/checkpoint/run.sh      (from anywhere; CXX picks the compiler)
+
+here=$(cd "$(dirname "$0")" && pwd)
+source="$here/../../nanLanguage.cpp"
+build=$(mktemp -d)
+failed=0
+
+trap 'rm -rf "$build"' EXIT
+
+if ! ${CXX:-g++} -std=c++17 -O2 -pthread "$source" -o "$build/nanLanguage"; then
+    echo "FAIL checkpoint (build)"
+    exit 1
+fi
+
+cp "$here/files.txt" "$here/input.txt" "$build/"
+cd "$build" || exit 1
+
+# same <name> <file>
+same() {
+    if diff -u "$here/expected/$1" "$2"; then
+        echo "ok   $1"
+    else
+        echo "FAIL $1"
+        failed=1
+    fi
+}
+
+./nanLanguage files.txt > out.txt 2>&1
+
+# The snapshot is written by a forked process; wait for it
+tries=0
+while [ ! -f files.txt.snapshot ] && [ $tries -lt 50 ]; do
+    sleep 0.1
+    tries=$((tries + 1))
+done
+
+./nanLanguage --resume files.txt.snapshot >> out.txt 2>&1
+
+same lines.txt lines.txt
+same out.txt out.txt
+
+exit $failed
@@ -0,0 +1,44 @@
+#!/bin/sh
+# Builds the interpreter once per runtime policy and checks that the
+# arithmetic edge cases print what tests/policies/expected/<policy>.txt says.
+#
+# Usage: tests/policies/run.sh        (from anywhere; CXX picks the compiler)
+
+here=$(cd "$(dirname "$0")" && pwd)
+source="$here/../../nanLanguage.cpp"
+build=$(mktemp -d)
+failed=0
+
+trap 'rm -rf "$build"' EXIT
+
+# check <policy> "<flags>" <scripts...>
+check() {
+    policy=$1
+    flags=$2
+    shift 2
+
+    if ! ${CXX:-g++} -std=c++17 -O2 -pthread $flags "$source" -o "$build/$policy"; then
+        echo "FAIL $policy (build)"
+        failed=1
+        return
+    fi
+
+    for script in "$@"; do
+        "$build/$policy" "$here/$script"
+    done > "$build/$policy.out" 2>&1
+
+    if diff -u "$here/expected/$policy.txt" "$build/$policy.out"; then
+        echo "ok   $policy"
+    else
+        echo "FAIL $policy"
+        failed=1
+    fi
+}
+
+check default        ""                                 arithmetic32.txt divzero.txt
+check int64          "-DNAN_INT64"                      arithmetic32.txt arithmetic64.txt divzero.txt
+check check_overflow "-DNAN_CHECK_OVERFLOW"             arithmetic32.txt divzero.txt
+check int64_overflow "-DNAN_INT64 -DNAN_CHECK_OVERFLOW" arithmetic32.txt arithmetic64.txt divzero.txt
+check unchecked      "-DNAN_UNCHECKED"                  arithmetic32.txt
+
+exit $failed